@@ -0,0 +1,512 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// AudioRecorder.cpp : write-behind recording of streamed audio to rotating WAV segments
+
+#include "stdafx.h"
+#include "AudioRecorder.h"
+#include "WavConverter.h"
+#include "Tracer.h"
+
+//samples gathered in m_pcm before a write
+#define RECORDER_PCM_SAMPLES (RECORDER_WRITE_SIZE / 2)
+
+#define RECORDER_SEGMENT_BYTES (RECORDER_SEGMENT_SECONDS * RECORDER_SAMPLE_RATE * 2)
+
+AudioRecorder::AudioRecorder()
+{
+	m_ring = NULL;
+	m_write = 0;
+	m_read = 0;
+	m_wrap = 0;
+	m_acquired = NULL;
+	m_acquired_size = 0;
+	m_acquired_wraps = false;
+	m_dropped = 0;
+	m_source = NULL;
+	m_format = RECORDER_FORMAT_SAMPLES;
+	m_prefix[0] = 0;
+	m_thread = NULL;
+	m_stop = 0;
+	m_pcm = NULL;
+	m_staging = NULL;
+	m_pcm_count = 0;
+	m_last_flush = 0;
+	m_segment = INVALID_HANDLE_VALUE;
+	m_segment_index = 0;
+	m_segment_bytes = 0;
+}
+
+AudioRecorder::~AudioRecorder()
+{
+	stop();
+	free(m_ring);
+}
+
+/*
+	Starts recording into segments named <prefix>_<n>.wav, from the sample loop's
+	commits or from the frames written to source
+
+	Returns 1 for success, 0 for failure
+*/
+int AudioRecorder::start(LPCWSTR prefix, int format, BroadcastRing * source)
+{
+	if (m_thread != NULL)
+	{
+		return 0;
+	}
+
+	//frames from a source are copied out and checked before they're converted, there's no ring of our own to fill
+	//the ring is kept after stop, as a sample loop may still be writing a frame into it
+	if (source == NULL && m_ring == NULL)
+	{
+		m_ring = (UINT8 *)malloc(RECORDER_RING_SIZE);
+	}
+	m_staging = (source != NULL) ? (UINT8 *)malloc(BROADCAST_RING_SIZE / 2) : NULL;
+	m_pcm = (INT16 *)malloc(sizeof(INT16)* RECORDER_PCM_SAMPLES);
+	if ((source == NULL && m_ring == NULL) || (source != NULL && m_staging == NULL) || m_pcm == NULL
+		|| (source != NULL && !source->attach(&m_reader)))
+	{
+		free(m_staging);
+		free(m_pcm);
+		m_staging = NULL;
+		m_pcm = NULL;
+		return 0;
+	}
+
+	swprintf_s(m_prefix, MAX_PATH, L"%s", prefix);
+	m_format = format;
+	m_write = 0;
+	m_read = 0;
+	m_wrap = 0;
+	m_acquired = NULL;
+	m_dropped = 0;
+	m_source = source;
+	m_stop = 0;
+	m_pcm_count = 0;
+	m_last_flush = GetTickCount();
+	m_segment_index = nextSegment();
+
+	/*
+		The writer stays at normal priority and the sample loops yield to it between
+		frames. Below normal, it would only get the single core from starvation boosts
+		while a loop busy waits, and the ring would fill during a long talk burst.
+	*/
+	m_thread = CreateThread(NULL, 0, writerThread, this, 0, NULL);
+	if (m_thread == NULL)
+	{
+		free(m_staging);
+		free(m_pcm);
+		m_staging = NULL;
+		m_pcm = NULL;
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+	Writes out everything committed so far, finishes the current segment and stops
+	the writer thread. A sample loop may still be recording, as when the console is
+	closed mid-stream, the frames it hands over from then on are not logged.
+*/
+void AudioRecorder::stop()
+{
+	if (m_thread == NULL)
+	{
+		return;
+	}
+
+	InterlockedExchange(&m_stop, 1);
+	WaitForSingleObject(m_thread, INFINITE);
+	CloseHandle(m_thread);
+	m_thread = NULL;
+
+	free(m_staging);
+	free(m_pcm);
+	m_staging = NULL;
+	m_pcm = NULL;
+	m_acquired = NULL;
+	m_source = NULL;
+}
+
+/*
+	Hands out space in the ring buffer for the next frame. Only the sample loop
+	recording to this recorder may call it, it never blocks.
+
+	The write position never catches up with the read position, so a full ring
+	can't be mistaken for an empty one.
+*/
+UINT8 * AudioRecorder::acquire(DWORD size)
+{
+	LONG read;
+	LONG write = m_write;
+
+	m_acquired = NULL;
+	if (m_ring == NULL || m_stop != 0)
+	{
+		return NULL;
+	}
+	if (size == 0 || size > RECORDER_RING_SIZE / 2)
+	{
+		m_dropped++;
+		return NULL;
+	}
+
+	read = m_read;
+	MemoryBarrier();
+
+	m_acquired_wraps = false;
+	if (write >= read)
+	{
+		if (write + (LONG)size < RECORDER_RING_SIZE)
+		{
+			m_acquired = &m_ring[write];
+		}
+		else if ((LONG)size < read)
+		{
+			//not enough room before the end, start again at the beginning
+			m_acquired = m_ring;
+			m_acquired_wraps = true;
+		}
+	}
+	else if (write + (LONG)size < read)
+	{
+		m_acquired = &m_ring[write];
+	}
+
+	if (m_acquired == NULL)
+	{
+		//the writer is behind, most likely a disk stall
+		m_dropped++;
+		return NULL;
+	}
+
+	m_acquired_size = size;
+	return m_acquired;
+}
+
+/*
+	Passes a frame to the writer. Does nothing if buffer wasn't the last pointer
+	returned by acquire.
+*/
+void AudioRecorder::commit(const void * buffer, DWORD length)
+{
+	if (buffer == NULL || buffer != m_acquired)
+	{
+		return;
+	}
+	m_acquired = NULL;
+
+	//keep the write position even, so 16 bit samples stay aligned
+	length = min(length, m_acquired_size) & ~1;
+	if (length == 0)
+	{
+		return;
+	}
+
+	//publish the frame only after it has been written, and the wrap point before the wrap
+	MemoryBarrier();
+	if (m_acquired_wraps)
+	{
+		m_wrap = m_write;
+		MemoryBarrier();
+		InterlockedExchange(&m_write, (LONG)length);
+	}
+	else
+	{
+		InterlockedExchange(&m_write, m_write + (LONG)length);
+	}
+}
+
+/*
+	Frames dropped because the writer was behind
+*/
+LONG AudioRecorder::droppedFrames()
+{
+	return m_dropped;
+}
+
+/*
+	Returns the ring acquire hands out space in, NULL if the recorder has never been
+	started without a source
+*/
+UINT8 * AudioRecorder::buffer()
+{
+	return m_ring;
+}
+
+/*
+	Entry point of the writer thread
+*/
+DWORD WINAPI AudioRecorder::writerThread(LPVOID param)
+{
+	AudioRecorder * recorder = (AudioRecorder *)param;
+
+	TRACE_THREAD_NAME("recorder");
+
+	while (true)
+	{
+		bool stopping = recorder->m_stop != 0;
+
+		if (recorder->m_source != NULL)
+		{
+			recorder->drainSource();
+		}
+		else
+		{
+			recorder->drain();
+		}
+		if (recorder->m_pcm_count > 0 && (stopping || GetTickCount() - recorder->m_last_flush >= RECORDER_FLUSH_MS))
+		{
+			recorder->flush();
+		}
+		if (stopping)
+		{
+			break;
+		}
+
+		Sleep(RECORDER_POLL_MS);
+	}
+
+	recorder->closeSegment();
+	return 0;
+}
+
+/*
+	Converts committed bytes out of the ring into 16 bit PCM, writing to disk as
+	blocks fill up. Space in the ring is given back as soon as it has been converted.
+*/
+void AudioRecorder::drain()
+{
+	while (true)
+	{
+		LONG write = m_write;
+		LONG read = m_read;
+		MemoryBarrier();
+
+		LONG end = (write >= read) ? write : m_wrap;
+		if (end == read)
+		{
+			if (write < read)
+			{
+				//everything up to the wrap point is done, carry on from the start
+				InterlockedExchange(&m_read, 0);
+				continue;
+			}
+			return;
+		}
+
+		DWORD count = min((DWORD)(end - read) / 2, RECORDER_PCM_SAMPLES - m_pcm_count);
+		convert(&m_ring[read], count);
+		MemoryBarrier();
+		InterlockedExchange(&m_read, read + (LONG)(2 * count));
+
+		if (m_pcm_count == RECORDER_PCM_SAMPLES)
+		{
+			flush();
+		}
+	}
+}
+
+/*
+	Converts the frames written to the source ring into 16 bit PCM, writing to disk
+	as blocks fill up. Frames the ring overwrote before they were converted count as
+	dropped.
+*/
+void AudioRecorder::drainSource()
+{
+	const UINT8 * frame;
+	DWORD length = 0;
+	LONG skipped = m_reader.skipped;
+
+	while ((frame = m_source->read(&m_reader, &length)) != NULL)
+	{
+		/*
+			Copy the frame out and check it afterwards, the writer may have overwritten
+			it during the copy. Only frames still intact after the copy are converted,
+			so nothing torn ever reaches the disk.
+		*/
+		length = min(length, (DWORD)(BROADCAST_RING_SIZE / 2));
+		memcpy(m_staging, frame, length);
+		if (!m_source->release(&m_reader))
+		{
+			continue;
+		}
+
+		for (DWORD n = 0; n < length / 2;)
+		{
+			DWORD count = min(length / 2 - n, RECORDER_PCM_SAMPLES - m_pcm_count);
+			convert(&m_staging[2 * n], count);
+			n += count;
+
+			if (m_pcm_count == RECORDER_PCM_SAMPLES)
+			{
+				flush();
+			}
+		}
+	}
+
+	InterlockedExchangeAdd(&m_dropped, m_reader.skipped - skipped);
+}
+
+/*
+	Converts count samples to 16 bit PCM at the end of m_pcm
+*/
+void AudioRecorder::convert(const UINT8 * source, DWORD count)
+{
+	INT16 * pcm = &m_pcm[m_pcm_count];
+
+	if (m_format == RECORDER_FORMAT_DAC_WORDS)
+	{
+		for (DWORD n = 0; n < count; n++)
+		{
+			UINT16 sample = (UINT16)(((source[2 * n] & 0x0F) << 8) | source[2 * n + 1]);
+			pcm[n] = (INT16)((sample - 2048) << 4);
+		}
+	}
+	else
+	{
+		const UINT16 * samples = (const UINT16 *)source;
+		for (DWORD n = 0; n < count; n++)
+		{
+			pcm[n] = (INT16)(((samples[n] & 0x0FFF) - 2048) << 4);
+		}
+	}
+
+	m_pcm_count += count;
+}
+
+/*
+	Writes the gathered PCM to the current segment, rotating segments as they fill.
+	If the disk fails the block is lost, recording carries on with the next one.
+*/
+void AudioRecorder::flush()
+{
+	const UINT8 * bytes = (const UINT8 *)m_pcm;
+	DWORD remaining = m_pcm_count * 2;
+	DWORD written = 0;
+
+	TRACE_SCOPE("disk write");
+	while (remaining > 0)
+	{
+		if (m_segment == INVALID_HANDLE_VALUE || m_segment_bytes >= RECORDER_SEGMENT_BYTES)
+		{
+			if (!openSegment())
+			{
+				break;
+			}
+		}
+
+		DWORD length = min(remaining, RECORDER_SEGMENT_BYTES - m_segment_bytes);
+		if (!WriteFile(m_segment, bytes, length, &written, NULL) || written != length)
+		{
+			break;
+		}
+		m_segment_bytes += length;
+		bytes += length;
+		remaining -= length;
+	}
+
+	//keep the sizes in the header current, the communicator is usually stopped by cutting the power
+	if (m_segment != INVALID_HANDLE_VALUE)
+	{
+		SetFilePointer(m_segment, 0, NULL, FILE_BEGIN);
+		WavConverter::writeWavHeader(m_segment, RECORDER_SAMPLE_RATE, m_segment_bytes);
+		SetFilePointer(m_segment, 0, NULL, FILE_END);
+	}
+
+	m_pcm_count = 0;
+	m_last_flush = GetTickCount();
+}
+
+/*
+	Finishes the current segment, if any, and opens the next one
+
+	Returns 1 for success, 0 for failure
+*/
+int AudioRecorder::openSegment()
+{
+	WCHAR name[MAX_PATH];
+
+	closeSegment();
+
+	swprintf_s(name, MAX_PATH, L"%s_%d.wav", m_prefix, m_segment_index);
+	m_segment_index = (m_segment_index + 1) % RECORDER_SEGMENT_COUNT;
+
+	m_segment = CreateFile(name, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_segment == INVALID_HANDLE_VALUE)
+	{
+		return 0;
+	}
+
+	//the sizes are filled in after each write
+	m_segment_bytes = 0;
+	if (!WavConverter::writeWavHeader(m_segment, RECORDER_SAMPLE_RATE, 0))
+	{
+		closeSegment();
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+	Finds the segment written last by an earlier run, so a restart carries on after
+	it rather than overwriting the audio that led up to the restart
+
+	Returns the index of the segment to write first
+*/
+int AudioRecorder::nextSegment()
+{
+	WCHAR name[MAX_PATH];
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	FILETIME written[RECORDER_SEGMENT_COUNT];
+	bool found[RECORDER_SEGMENT_COUNT];
+	int newest = -1;
+
+	for (int n = 0; n < RECORDER_SEGMENT_COUNT; n++)
+	{
+		swprintf_s(name, MAX_PATH, L"%s_%d.wav", m_prefix, n);
+		found[n] = GetFileAttributesEx(name, GetFileExInfoStandard, &attributes) != 0;
+		written[n] = attributes.ftLastWriteTime;
+		if (found[n] && (newest < 0 || CompareFileTime(&written[n], &written[newest]) > 0))
+		{
+			newest = n;
+		}
+	}
+	if (newest < 0)
+	{
+		return 0;
+	}
+
+	//FAT keeps write times to 2 seconds, of segments written together the last is the one the next doesn't share the time with
+	for (int n = 0; n < RECORDER_SEGMENT_COUNT; n++)
+	{
+		int next = (newest + 1) % RECORDER_SEGMENT_COUNT;
+		if (!found[next] || CompareFileTime(&written[next], &written[newest]) != 0)
+		{
+			break;
+		}
+		newest = next;
+	}
+
+	return (newest + 1) % RECORDER_SEGMENT_COUNT;
+}
+
+/*
+	Fills in the sizes in the header of the current segment and closes it
+*/
+void AudioRecorder::closeSegment()
+{
+	if (m_segment == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+
+	SetFilePointer(m_segment, 0, NULL, FILE_BEGIN);
+	WavConverter::writeWavHeader(m_segment, RECORDER_SAMPLE_RATE, m_segment_bytes);
+	CloseHandle(m_segment);
+	m_segment = INVALID_HANDLE_VALUE;
+}
@@ -0,0 +1,165 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* AudioRecorder keeps a log of streamed audio in rotating WAV segments. The sample loops
+* capture straight into the recorder's ring buffer, or the recorder reads frames from a
+* BroadcastRing, and a background thread converts them and writes them to disk in large
+* blocks. If the disk falls behind, frames are dropped and counted rather than holding
+* up the sample loops.
+**/
+
+#ifndef AUDIORECORDER_H
+#define AUDIORECORDER_H
+
+#include "windows.h"
+#include "BroadcastRing.h"
+
+//what the sample loops hand to the recorder
+#define RECORDER_FORMAT_SAMPLES 0 //12 bit samples, one UINT16 each
+#define RECORDER_FORMAT_DAC_WORDS 1 //DAC words as sent over SPI, high byte first
+
+#define RECORDER_SAMPLE_RATE 16000
+
+//ring buffer between the sample loops and the writer, about 30s of audio
+//a single acquire can be at most half of it
+#define RECORDER_RING_SIZE (1024 * 1024)
+
+//bytes of 16 bit PCM gathered before each write to disk
+#define RECORDER_WRITE_SIZE (64 * 1024)
+
+//how often the writer looks for new audio, and how long it holds a partial block
+#define RECORDER_POLL_MS 20
+#define RECORDER_FLUSH_MS 1000
+
+//each segment holds this many seconds, after RECORDER_SEGMENT_COUNT the oldest is overwritten
+//a new recording carries on after the segment written last, so a restart keeps the earlier audio
+#define RECORDER_SEGMENT_SECONDS 300
+#define RECORDER_SEGMENT_COUNT 12
+
+class AudioRecorder{
+public:
+	AudioRecorder();
+	~AudioRecorder();
+
+	/*
+		Starts recording into segments named <prefix>_<n>.wav, after the one an
+		earlier recording wrote last
+
+		@params:
+		prefix - path and name of the segment files, without the extension
+		format - RECORDER_FORMAT_SAMPLES or RECORDER_FORMAT_DAC_WORDS
+		source - a ring to record the frames of, instead of using acquire and commit
+
+		Returns 1 for success, 0 for failure
+	*/
+	int start(LPCWSTR prefix, int format, BroadcastRing * source = NULL);
+
+	/*
+		Writes out everything committed so far, finishes the current segment and stops
+		the writer thread. It may be called while a sample loop is still recording.
+	*/
+	void stop();
+
+	/*
+		Hands out space in the ring buffer for the next frame. Only the sample loop
+		recording to this recorder may call it, it never blocks.
+
+		@params:
+		size - the largest number of bytes the frame will need
+
+		Returns a pointer to size bytes, or NULL if the recorder isn't running or the
+		writer is behind. A NULL while running counts as a dropped frame.
+	*/
+	UINT8 * acquire(DWORD size);
+
+	/*
+		Passes a frame to the writer. Does nothing if buffer wasn't the last pointer
+		returned by acquire, so loops can commit a fallback buffer unconditionally.
+		The committed bytes stay untouched until the next commit.
+
+		@params:
+		buffer - the pointer returned by acquire
+		length - the number of bytes used, at most the size acquired
+	*/
+	void commit(const void * buffer, DWORD length);
+
+	/*
+		Frames dropped because the writer was behind
+	*/
+	LONG droppedFrames();
+
+	/*
+		Returns the RECORDER_RING_SIZE ring acquire hands out space in, NULL if the
+		recorder has never been started without a source
+	*/
+	UINT8 * buffer();
+
+private:
+	/*
+		Entry point of the writer thread
+	*/
+	static DWORD WINAPI writerThread(LPVOID param);
+
+	/*
+		Converts committed bytes out of the ring, writing to disk as blocks fill up
+	*/
+	void drain();
+
+	/*
+		Converts the frames written to the source ring, writing to disk as blocks fill up
+	*/
+	void drainSource();
+
+	/*
+		Converts count samples to 16 bit PCM at the end of m_pcm
+	*/
+	void convert(const UINT8 * source, DWORD count);
+
+	/*
+		Writes the gathered PCM to the current segment, rotating segments as they fill
+	*/
+	void flush();
+
+	/*
+		Finishes the current segment, if any, and opens the next one
+	*/
+	int openSegment();
+
+	/*
+		Returns the index after the segment written last, 0 if there are none
+	*/
+	int nextSegment();
+
+	/*
+		Fills in the sizes in the header of the current segment and closes it
+	*/
+	void closeSegment();
+
+	UINT8 * m_ring;
+	volatile LONG m_write; //next byte the sample loop writes, only it changes this
+	volatile LONG m_read; //next byte the writer reads, only it changes this
+	volatile LONG m_wrap; //where the data ends when the sample loop has wrapped to the start
+	UINT8 * m_acquired; //last pointer handed out by acquire
+	DWORD m_acquired_size;
+	bool m_acquired_wraps; //the space handed out starts back at the beginning of the ring
+	volatile LONG m_dropped;
+	BroadcastRing * m_source; //ring recorded from, if not recording through acquire and commit
+	BroadcastReader m_reader;
+	UINT8 * m_staging; //copy of the source frame being converted, checked intact before use
+
+	int m_format;
+	WCHAR m_prefix[MAX_PATH];
+	HANDLE m_thread;
+	volatile LONG m_stop;
+
+	INT16 * m_pcm; //16 bit PCM waiting to be written
+	DWORD m_pcm_count; //samples in m_pcm
+	DWORD m_last_flush; //tick count of the last write
+	HANDLE m_segment;
+	int m_segment_index;
+	DWORD m_segment_bytes; //PCM bytes in the current segment
+};
+
+#endif
@@ -0,0 +1,249 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// BroadcastRing.cpp : single writer, multiple reader ring of frames read in place
+
+#include "stdafx.h"
+#include "BroadcastRing.h"
+
+//length of the header that fills the end of the ring when a frame doesn't fit there
+#define BROADCAST_PADDING 0xFFFFFFFF
+
+//precedes each frame in the ring
+struct BroadcastHeader{
+	UINT32 length;
+	UINT32 sequence;
+};
+
+//frames start on 8 byte boundaries, so there is always room for a header before the end
+#define BROADCAST_RECORD_SIZE(length) (sizeof(BroadcastHeader) + (((length) + 7) & ~7))
+
+BroadcastRing::BroadcastRing()
+{
+	m_ring = NULL;
+	m_write = 0;
+	m_claimed = 0;
+	m_sequence = 0;
+	m_acquired = NULL;
+	m_acquired_size = 0;
+}
+
+BroadcastRing::~BroadcastRing()
+{
+	free(m_ring);
+}
+
+/*
+	Starts a reader at the newest frame, allocating the ring for the first one
+
+	Returns 1 for success, 0 if the ring couldn't be allocated
+*/
+int BroadcastRing::attach(BroadcastReader * reader)
+{
+	if (m_ring == NULL)
+	{
+		UINT8 * ring = (UINT8 *)malloc(BROADCAST_RING_SIZE);
+		if (ring == NULL)
+		{
+			return 0;
+		}
+
+		//the writer may already be checking for the ring, hand it over complete
+		MemoryBarrier();
+		m_ring = ring;
+	}
+
+	reader->position = (DWORD)m_write;
+	reader->length = 0;
+	reader->sequence = 0;
+	reader->synced = false;
+	reader->skipped = 0;
+	return 1;
+}
+
+/*
+	Hands out space for the next frame, overwriting the oldest frames if needed.
+	Readers are told about the space before it is written, so they can tell a frame
+	was overwritten under them.
+*/
+UINT8 * BroadcastRing::acquire(DWORD size)
+{
+	DWORD write = (DWORD)m_write;
+	DWORD offset = write % BROADCAST_RING_SIZE;
+	DWORD record = BROADCAST_RECORD_SIZE(size);
+
+	m_acquired = NULL;
+	if (m_ring == NULL || size == 0 || size > BROADCAST_RING_SIZE / 2)
+	{
+		return NULL;
+	}
+
+	if (offset + record > BROADCAST_RING_SIZE)
+	{
+		//not enough room before the end, readers skip from a padding header to the start
+		DWORD padding = BROADCAST_RING_SIZE - offset;
+		claim(write + padding + record);
+
+		BroadcastHeader * header = (BroadcastHeader *)&m_ring[offset];
+		header->length = BROADCAST_PADDING;
+		header->sequence = m_sequence;
+		MemoryBarrier();
+
+		write += padding;
+		offset = 0;
+		InterlockedExchange(&m_write, (LONG)write);
+	}
+	else
+	{
+		claim(write + record);
+	}
+
+	m_acquired = &m_ring[offset + sizeof(BroadcastHeader)];
+	m_acquired_size = size;
+	return m_acquired;
+}
+
+/*
+	Publishes a frame to the readers. Does nothing if buffer wasn't the last pointer
+	returned by acquire.
+*/
+void BroadcastRing::commit(const void * buffer, DWORD length)
+{
+	if (buffer == NULL || buffer != m_acquired)
+	{
+		return;
+	}
+	m_acquired = NULL;
+
+	length = min(length, m_acquired_size);
+	if (length == 0)
+	{
+		return;
+	}
+
+	BroadcastHeader * header = (BroadcastHeader *)(m_ring + ((DWORD)m_write % BROADCAST_RING_SIZE));
+	header->length = length;
+	header->sequence = m_sequence++;
+
+	//publish the frame only after it has been written
+	MemoryBarrier();
+	InterlockedExchange(&m_write, (LONG)((DWORD)m_write + BROADCAST_RECORD_SIZE(length)));
+}
+
+/*
+	Returns the next frame for a reader, in place, skipping to the newest frame
+	first if the reader had fallen behind
+
+	Returns the frame, or NULL if the reader is up to date
+*/
+const UINT8 * BroadcastRing::read(BroadcastReader * reader, DWORD * length)
+{
+	if (m_ring == NULL)
+	{
+		return NULL;
+	}
+
+	while (true)
+	{
+		DWORD write = (DWORD)m_write;
+		MemoryBarrier();
+
+		if (reader->position == write)
+		{
+			return NULL;
+		}
+		if (!intact(reader->position))
+		{
+			skip(reader);
+			continue;
+		}
+
+		const BroadcastHeader * header = (const BroadcastHeader *)&m_ring[reader->position % BROADCAST_RING_SIZE];
+		DWORD frame_length = header->length;
+		UINT32 sequence = header->sequence;
+
+		//the header could have been overwritten while it was read
+		MemoryBarrier();
+		if (!intact(reader->position))
+		{
+			skip(reader);
+			continue;
+		}
+
+		if (frame_length == BROADCAST_PADDING)
+		{
+			reader->position += BROADCAST_RING_SIZE - (reader->position % BROADCAST_RING_SIZE);
+			continue;
+		}
+
+		//frames missed by falling behind show up as a gap in the sequence
+		if (reader->synced)
+		{
+			reader->skipped += (LONG)(sequence - reader->sequence);
+		}
+		reader->sequence = sequence;
+		reader->synced = true;
+		reader->length = frame_length;
+
+		*length = frame_length;
+		return (const UINT8 *)(header + 1);
+	}
+}
+
+/*
+	Moves a reader past the frame returned by read
+
+	Returns 1 if the frame was intact, 0 if it was overwritten while being read
+*/
+int BroadcastRing::release(BroadcastReader * reader)
+{
+	MemoryBarrier();
+	if (!intact(reader->position))
+	{
+		//the frame counts as skipped when the reader next finds a frame
+		skip(reader);
+		return 0;
+	}
+
+	reader->position += BROADCAST_RECORD_SIZE(reader->length);
+	reader->sequence++;
+	return 1;
+}
+
+/*
+	Returns the ring's storage, NULL before the first reader attaches
+*/
+UINT8 * BroadcastRing::buffer()
+{
+	return m_ring;
+}
+
+/*
+	Returns true if the frame at position can't have been overwritten yet
+*/
+bool BroadcastRing::intact(DWORD position)
+{
+	return (LONG)((DWORD)m_claimed - position) <= BROADCAST_RING_SIZE;
+}
+
+/*
+	Tells readers the space up to end is about to be written. A commit shorter than
+	its acquire leaves the claim ahead of the next frame, so it never goes back.
+*/
+void BroadcastRing::claim(DWORD end)
+{
+	if ((LONG)(end - (DWORD)m_claimed) > 0)
+	{
+		InterlockedExchange(&m_claimed, (LONG)end);
+	}
+}
+
+/*
+	Moves a reader that has fallen behind up to the newest frame
+*/
+void BroadcastRing::skip(BroadcastReader * reader)
+{
+	reader->position = (DWORD)m_write;
+	reader->length = 0;
+}
@@ -0,0 +1,124 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* BroadcastRing hands the frames written by one sample loop to any number of readers on
+* other threads. The sample loop writes each frame straight into the ring and readers
+* read it where it lies, each with its own cursor. The writer never waits: a reader that
+* falls a whole ring behind is moved up to the newest frame and counts what it missed.
+**/
+
+#ifndef BROADCASTRING_H
+#define BROADCASTRING_H
+
+#include "windows.h"
+
+//about 30s of 16kHz DAC words, a single acquire can be at most half of it
+#define BROADCAST_RING_SIZE (1024 * 1024)
+
+/*
+	A reader's place in a BroadcastRing. Only the reader changes it.
+*/
+struct BroadcastReader{
+	DWORD position; //ring position of the next frame to read
+	DWORD length; //length of the frame being read
+	UINT32 sequence; //sequence number expected next
+	bool synced; //sequence has been set from a frame
+	LONG skipped; //frames missed from falling behind
+};
+
+class BroadcastRing{
+public:
+	BroadcastRing();
+	~BroadcastRing();
+
+	/*
+		Starts a reader at the newest frame. The first reader allocates the ring, so
+		attach the first one before the sample loop starts writing.
+
+		@params:
+		reader - the reader's cursor
+
+		Returns 1 for success, 0 if the ring couldn't be allocated
+	*/
+	int attach(BroadcastReader * reader);
+
+	/*
+		Hands out space for the next frame, overwriting the oldest frames if needed.
+		Only the sample loop writing to the ring may call it, it never blocks.
+
+		@params:
+		size - the largest number of bytes the frame will need
+
+		Returns a pointer to size bytes, or NULL if no reader has ever attached or size
+		is more than half the ring
+	*/
+	UINT8 * acquire(DWORD size);
+
+	/*
+		Publishes a frame to the readers. Does nothing if buffer wasn't the last pointer
+		returned by acquire, so loops can commit a fallback buffer unconditionally.
+		The frame stays in place until the next acquire, so the sample loop can keep
+		reading it.
+
+		@params:
+		buffer - the pointer returned by acquire
+		length - the number of bytes used, at most the size acquired
+	*/
+	void commit(const void * buffer, DWORD length);
+
+	/*
+		Returns the next frame for a reader, in place, without moving past it. If the
+		reader had fallen behind it skips to the newest frame first.
+
+		@params:
+		reader - the reader's cursor
+		length - set to the number of bytes in the frame
+
+		Returns the frame, or NULL if the reader is up to date
+	*/
+	const UINT8 * read(BroadcastReader * reader, DWORD * length);
+
+	/*
+		Moves a reader past the frame returned by read, and checks that the writer
+		didn't overwrite the frame while it was being read
+
+		@params:
+		reader - the reader's cursor
+
+		Returns 1 if the frame was intact, 0 if it was overwritten and whatever was
+		read from it should be thrown away
+	*/
+	int release(BroadcastReader * reader);
+
+	/*
+		Returns the ring's storage, NULL before the first reader attaches
+	*/
+	UINT8 * buffer();
+
+private:
+	/*
+		Returns true if the frame at position can't have been overwritten yet
+	*/
+	bool intact(DWORD position);
+
+	/*
+		Tells readers the space up to end is about to be written
+	*/
+	void claim(DWORD end);
+
+	/*
+		Moves a reader that has fallen behind up to the newest frame
+	*/
+	void skip(BroadcastReader * reader);
+
+	UINT8 * m_ring;
+	volatile LONG m_write; //ring position the next frame goes, only the writer changes this
+	volatile LONG m_claimed; //end of the space handed out, only the writer changes this
+	UINT32 m_sequence; //sequence number of the next frame
+	UINT8 * m_acquired; //last pointer handed out by acquire
+	DWORD m_acquired_size;
+};
+
+#endif
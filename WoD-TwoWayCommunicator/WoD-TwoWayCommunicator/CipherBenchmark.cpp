@@ -0,0 +1,151 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// CipherBenchmark.cpp : cost of sealing and opening audio packets against the frame budget
+
+#include "stdafx.h"
+#include "CipherBenchmark.h"
+#include "PacketCipher.h"
+#include "StreamProtocol.h"
+
+//packets sealed, then opened, between reads of the clock
+#define CIPHER_BATCH 64
+
+//frame lengths the rate controller steps between, in samples at 16kHz
+static const DWORD s_frame_samples[] = { 320, 640, 1600, 16000 };
+
+/*
+	Seals and opens packets of one size for seconds, printing one row of results
+
+	Returns 1 for success, 0 for failure
+*/
+static int measure(PacketCipher * sender, PacketCipher * receiver, DWORD samples, int seconds)
+{
+	DWORD packet_size = streamPacketSize(samples, 1, samples);
+	UINT8 * packet = (UINT8 *)malloc(packet_size);
+	UINT8 * opened = (UINT8 *)malloc(packet_size);
+	UINT8 * sealed = (UINT8 *)malloc((packet_size + CIPHER_OVERHEAD) * CIPHER_BATCH);
+	DWORD sealed_length[CIPHER_BATCH];
+	LARGE_INTEGER frequency, start, middle, end;
+	LONGLONG seal_ticks = 0;
+	LONGLONG open_ticks = 0;
+	UINT64 packets = 0;
+	UINT32 value = 1;
+	int result = 1;
+
+	if (packet == NULL || opened == NULL || sealed == NULL)
+	{
+		free(packet);
+		free(opened);
+		free(sealed);
+		return 0;
+	}
+
+	for (DWORD n = 0; n < packet_size; n++)
+	{
+		value = value * 1664525 + 1013904223;
+		packet[n] = (UINT8)(value >> 24);
+	}
+
+	QueryPerformanceFrequency(&frequency);
+	DWORD started = GetTickCount();
+
+	while (GetTickCount() - started < (DWORD)seconds * 1000)
+	{
+		QueryPerformanceCounter(&start);
+		for (int b = 0; b < CIPHER_BATCH; b++)
+		{
+			sealed_length[b] = sender->seal(&sealed[b * (packet_size + CIPHER_OVERHEAD)], packet, packet_size);
+		}
+		QueryPerformanceCounter(&middle);
+		for (int b = 0; b < CIPHER_BATCH; b++)
+		{
+			if (receiver->open(opened, packet_size, &sealed[b * (packet_size + CIPHER_OVERHEAD)], sealed_length[b]) != (int)packet_size)
+			{
+				result = 0;
+			}
+		}
+		QueryPerformanceCounter(&end);
+
+		seal_ticks += middle.QuadPart - start.QuadPart;
+		open_ticks += end.QuadPart - middle.QuadPart;
+		packets += CIPHER_BATCH;
+	}
+
+	if (result == 0 || memcmp(opened, packet, packet_size) != 0)
+	{
+		printf("%6.0f %8u packets did not open\n", samples * 1000.0 / STREAM_CLOCK_RATE, packet_size);
+		result = 0;
+	}
+	else
+	{
+		double seal_us = seal_ticks * 1000000.0 / frequency.QuadPart / packets;
+		double open_us = open_ticks * 1000000.0 / frequency.QuadPart / packets;
+		double frame_us = samples * 1000000.0 / STREAM_CLOCK_RATE;
+
+		printf("%6.0f %8u %9.1f %9.1f %9.2f %9.3f\n", frame_us / 1000, packet_size, seal_us, open_us,
+			packet_size / (seal_us + open_us) * 2, (seal_us + open_us) * 100 / frame_us);
+	}
+
+	free(packet);
+	free(opened);
+	free(sealed);
+	return result;
+}
+
+/*
+	Checks the cipher, then measures sealing and opening packets of each frame length
+
+	Returns 1 for success, 0 for failure
+*/
+int RunCipherBenchmark(int seconds)
+{
+	PacketCipher sender;
+	PacketCipher receiver;
+	UINT8 key[CIPHER_KEY_SIZE];
+
+	if (!PacketCipher::selfTest())
+	{
+		printf("cipher does not match its test vectors\n");
+		return 0;
+	}
+	if (!PacketCipher::sessionTest())
+	{
+		printf("a replayed packet of an old session took over the live one\n");
+		return 0;
+	}
+
+	for (int n = 0; n < CIPHER_KEY_SIZE; n++)
+	{
+		key[n] = (UINT8)n;
+	}
+	if (!sender.setKey(key) || !receiver.setKey(key))
+	{
+		printf("could not set the key\n");
+		return 0;
+	}
+
+	//the receiver holds back the first packets of the sender's session until it trusts it
+	for (int n = 0; n < CIPHER_CANDIDATE_PACKETS; n++)
+	{
+		UINT8 sealed[sizeof(key) + CIPHER_OVERHEAD];
+		UINT8 opened[sizeof(key)];
+
+		receiver.open(opened, sizeof(opened), sealed, sender.seal(sealed, key, sizeof(key)));
+	}
+
+	printf("XChaCha20-Poly1305 on audio packets with redundancy, %ds per frame length\n", seconds);
+	printf("%6s %8s %9s %9s %9s %9s\n", "ms", "bytes", "seal us", "open us", "MB/s", "budget %");
+
+	int result = 1;
+	for (int f = 0; f < (int)(sizeof(s_frame_samples) / sizeof(s_frame_samples[0])); f++)
+	{
+		if (!measure(&sender, &receiver, s_frame_samples[f], seconds))
+		{
+			result = 0;
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,28 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* CipherBenchmark measures what sealing and opening audio packets costs against the
+* time each frame covers
+**/
+
+#ifndef CIPHERBENCHMARK_H
+#define CIPHERBENCHMARK_H
+
+#include "windows.h"
+
+/*
+	Checks the cipher against its test vectors, then seals and opens audio packets of
+	each frame length the stream uses, with redundancy, for seconds per length. Prints
+	the microseconds per seal and per open, the throughput, and the share of the
+	frame's 16kHz budget spent on both.
+
+	@params:
+	seconds - how long each frame length is measured for
+
+	Returns 1 for success, 0 for failure
+*/
+int RunCipherBenchmark(int seconds);
+
+#endif
@@ -1,185 +1,319 @@
-// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
-// Licensed under the BSD 2 - Clause License.
-// See License.txt in the project root for license information.
-
-// Communicator.cpp : a wrapper for setup and management of UDP communication
-
-#include "Communicator.h"
-
-#include <winsock.h>
-
-SOCKET m_partner_socket;
-WSADATA m_wsdata;
-sockaddr_in m_server;
-sockaddr_in m_dest;
-const char * m_serv_hostname;
-const char * m_dest_hostname;
-
-Communicator::Communicator(){
-
-}
-
-Communicator::~Communicator(){
-}
-
-/*
-	Starts the required Windows conection
-
-	Returns 1 for _success, 0 for failure
-*/
-int Communicator::startWindowsConnection(){
-	WORD wVersionRequested = MAKEWORD(2, 2);
-	if (WSAStartup(wVersionRequested, &m_wsdata) != 0)
-	{
-		return 0;
-	}
-	return 1; //1 for _success
-}
-
-int Communicator::closeWindowsConnection(){
-	closesocket(m_partner_socket);
-	return WSACleanup();
-}
-
-/*
-Opens a UDP Socket
-
--1 for failure, else returns the sd
-*/
-int Communicator::openUDPSocket(){
-	m_partner_socket = socket(AF_INET, SOCK_DGRAM, 0);
-	if (m_partner_socket == INVALID_SOCKET){
-		//cleanup windows connection and return 0
-		WSACleanup();
-
-		return -1;
-	}
-	int buffer_size = 100000000;
-	setsockopt(m_partner_socket, SOL_SOCKET, SO_RCVBUF, (char *)&buffer_size, sizeof(int));
-
-	//set the socket to be nonblocking
-	u_long non_blocking = 1;
-	ioctlsocket(m_partner_socket, FIONBIO, &non_blocking);
-
-	return 1; //1 for _success
-}
-
-/*
-Setup m_server details and bind
-*/
-int Communicator::setupServerAndBind(const char * serv_hostname){
-	hostent * host;
-	m_serv_hostname = serv_hostname;
-	host = gethostbyname(m_serv_hostname);
-
-	if (host == NULL){
-		//failed hostname lookup
-		WSACleanup();
-		return 0;
-	}
-
-	/* Set family and port */
-	m_server.sin_family = AF_INET;
-	m_server.sin_port = htons(PORT_NUMBER);
-	m_server.sin_addr.S_un.S_un_b.s_b1 = host->h_addr_list[0][0];
-	m_server.sin_addr.S_un.S_un_b.s_b2 = host->h_addr_list[0][1];
-	m_server.sin_addr.S_un.S_un_b.s_b3 = host->h_addr_list[0][2];
-	m_server.sin_addr.S_un.S_un_b.s_b4 = host->h_addr_list[0][3];
-	
-	if (bind(m_partner_socket, (struct sockaddr *)&m_server, sizeof(m_server))){
-		int se;
-		se = WSAGetLastError();
-
-		WSACleanup();
-		closesocket(m_partner_socket);
-		return 0;
-	}
-	
-	
-	return 1;
-};
-
-/*
-Setup m_dest details
-*/
-int Communicator::setupDestination(const char * dest_hostname){
-	hostent * host;
-	m_dest_hostname = dest_hostname;
-	host = gethostbyname(dest_hostname);
-
-	while (host == NULL){
-		/*
-		  failed hostname lookup
-		  keep looking for the receiver
-		  we do this because the two communicator boxes won't boot at the same time
-		  so one will always be first and not be able to find the other one
-		
-		  Of course, this means that the application will hang here until the partner
-		  is discovered.
-		*/
-		host = gethostbyname(dest_hostname);
-	}
-
-	/* Set family and port */
-	m_dest.sin_family = AF_INET;
-	m_dest.sin_port = htons(PORT_NUMBER);
-	m_dest.sin_addr.S_un.S_un_b.s_b1 = host->h_addr_list[0][0];
-	m_dest.sin_addr.S_un.S_un_b.s_b2 = host->h_addr_list[0][1];
-	m_dest.sin_addr.S_un.S_un_b.s_b3 = host->h_addr_list[0][2];
-	m_dest.sin_addr.S_un.S_un_b.s_b4 = host->h_addr_list[0][3];
-
-
-	return 1;
-};
-
-/*
-Receives the 16bit DAC command for the DAC from the sender application
-*/
-UINT16 Communicator::receiveSample(){
-	
-	char * bytes = new char[4];
-	int bytecount = -1;
-	bytecount = recv(m_partner_socket, bytes, 4, 0);
-	
-	if (bytecount == -1){
-		int se;
-		se = WSAGetLastError();
-
-		return 0;
-	}
-	
-	UINT16 val = *(UINT16 *)bytes;
-
-	delete bytes;
-	return val;
-}
-
-/*
-Receives the 16bit DAC command chunk for the DAC from the sender application
-*/
-UINT16 Communicator::receiveUDPChunk(char * recv_data, int chunk_size){
-
-	int bytecount = -1;
-	bytecount = recv(m_partner_socket, (char *)recv_data, chunk_size, 0);
-
-	if (bytecount < 0){
-		int se;
-		se = WSAGetLastError();
-
-		return se;
-	}
-
-
-	return bytecount;
-}
-
-
-
-/*
-Sends bytes to dest
-*/
-int Communicator::sendUDPChunk(char * chunk, int chunk_size){
-
-	return sendto(m_partner_socket, (char *)chunk, chunk_size, 0, (sockaddr *)&m_dest, sizeof(m_dest));
-
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// Communicator.cpp : a wrapper for setup and management of UDP communication
+
+#include "Communicator.h"
+#include "Tracer.h"
+
+Communicator::Communicator(){
+	m_partner_socket = INVALID_SOCKET;
+	memset(&m_server, 0, sizeof(m_server));
+	memset(&m_dest, 0, sizeof(m_dest));
+	memset(&m_source, 0, sizeof(m_source));
+	m_serv_hostname = NULL;
+	m_dest_hostname = NULL;
+	m_sealed = NULL;
+	m_started = false;
+}
+
+Communicator::~Communicator(){
+	//balances startWindowsConnection if the owner didn't close the connection
+	closeWindowsConnection();
+	free(m_sealed);
+}
+
+/*
+	Starts the required Windows conection
+
+	Returns 1 for _success, 0 for failure
+*/
+int Communicator::startWindowsConnection(){
+	WORD wVersionRequested = MAKEWORD(2, 2);
+	if (WSAStartup(wVersionRequested, &m_wsdata) != 0)
+	{
+		return 0;
+	}
+	m_started = true;
+	return 1; //1 for _success
+}
+
+/*
+	Closes the socket and ends the Windows connection, once for each successful
+	startWindowsConnection. The setup calls leave the cleanup to this on failure.
+*/
+int Communicator::closeWindowsConnection(){
+	if (m_partner_socket != INVALID_SOCKET){
+		closesocket(m_partner_socket);
+		m_partner_socket = INVALID_SOCKET;
+	}
+	if (!m_started){
+		return 0;
+	}
+	m_started = false;
+	return WSACleanup();
+}
+
+/*
+	Closes the connection and forgets the addresses, ready to be set up again.
+	The preshared key, if one was set, stays set.
+*/
+void Communicator::reset(){
+	closeWindowsConnection();
+	memset(&m_server, 0, sizeof(m_server));
+	memset(&m_dest, 0, sizeof(m_dest));
+	memset(&m_source, 0, sizeof(m_source));
+	m_serv_hostname = NULL;
+	m_dest_hostname = NULL;
+}
+
+/*
+Opens a UDP Socket
+
+-1 for failure, else returns the sd
+*/
+int Communicator::openUDPSocket(){
+	m_partner_socket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (m_partner_socket == INVALID_SOCKET){
+		//closeWindowsConnection cleans up the windows connection
+		return -1;
+	}
+	int buffer_size = 100000000;
+	setsockopt(m_partner_socket, SOL_SOCKET, SO_RCVBUF, (char *)&buffer_size, sizeof(int));
+
+	//set the socket to be nonblocking
+	u_long non_blocking = 1;
+	ioctlsocket(m_partner_socket, FIONBIO, &non_blocking);
+
+	return 1; //1 for _success
+}
+
+/*
+Setup m_server details and bind
+*/
+int Communicator::setupServerAndBind(const char * serv_hostname, u_short port){
+	hostent * host;
+	m_serv_hostname = serv_hostname;
+	host = gethostbyname(m_serv_hostname);
+
+	if (host == NULL){
+		//failed hostname lookup
+		return 0;
+	}
+
+	/* Set family and port */
+	m_server.sin_family = AF_INET;
+	m_server.sin_port = htons(port);
+	m_server.sin_addr.S_un.S_un_b.s_b1 = host->h_addr_list[0][0];
+	m_server.sin_addr.S_un.S_un_b.s_b2 = host->h_addr_list[0][1];
+	m_server.sin_addr.S_un.S_un_b.s_b3 = host->h_addr_list[0][2];
+	m_server.sin_addr.S_un.S_un_b.s_b4 = host->h_addr_list[0][3];
+	
+	if (bind(m_partner_socket, (struct sockaddr *)&m_server, sizeof(m_server))){
+		int se;
+		se = WSAGetLastError();
+
+		closesocket(m_partner_socket);
+		m_partner_socket = INVALID_SOCKET;
+		return 0;
+	}
+	
+	
+	return 1;
+};
+
+/*
+Setup m_dest details
+*/
+int Communicator::setupDestination(const char * dest_hostname, u_short port){
+	hostent * host;
+	m_dest_hostname = dest_hostname;
+	host = gethostbyname(dest_hostname);
+
+	while (host == NULL){
+		/*
+		  failed hostname lookup
+		  keep looking for the receiver
+		  we do this because the two communicator boxes won't boot at the same time
+		  so one will always be first and not be able to find the other one
+		
+		  Of course, this means that the application will hang here until the partner
+		  is discovered.
+		*/
+		host = gethostbyname(dest_hostname);
+	}
+
+	/* Set family and port */
+	m_dest.sin_family = AF_INET;
+	m_dest.sin_port = htons(port);
+	m_dest.sin_addr.S_un.S_un_b.s_b1 = host->h_addr_list[0][0];
+	m_dest.sin_addr.S_un.S_un_b.s_b2 = host->h_addr_list[0][1];
+	m_dest.sin_addr.S_un.S_un_b.s_b3 = host->h_addr_list[0][2];
+	m_dest.sin_addr.S_un.S_un_b.s_b4 = host->h_addr_list[0][3];
+
+
+	return 1;
+};
+
+/*
+Receives the 16bit DAC command for the DAC from the sender application
+*/
+UINT16 Communicator::receiveSample(){
+	
+	char * bytes = new char[4];
+	int bytecount = -1;
+	bytecount = recv(m_partner_socket, bytes, 4, 0);
+	
+	if (bytecount == -1){
+		int se;
+		se = WSAGetLastError();
+
+		return 0;
+	}
+	
+	UINT16 val = *(UINT16 *)bytes;
+
+	delete bytes;
+	return val;
+}
+
+/*
+Receives the 16bit DAC command chunk for the DAC from the sender application
+
+Returns the number of bytes received, or SOCKET_ERROR if nothing was received,
+WSAEWOULDBLOCK from WSAGetLastError when there was nothing to receive
+*/
+int Communicator::receiveUDPChunk(char * recv_data, int chunk_size){
+
+	int bytecount = -1;
+	int source_size = sizeof(m_source);
+	TRACE_SCOPE_NAMED(trace, "recv");
+	if (m_cipher.enabled()){
+		bytecount = recvfrom(m_partner_socket, (char *)m_sealed, MAX_PACKET_SIZE, 0, (sockaddr *)&m_source, &source_size);
+	}
+	else{
+		bytecount = recvfrom(m_partner_socket, (char *)recv_data, chunk_size, 0, (sockaddr *)&m_source, &source_size);
+	}
+
+	if (bytecount < 0){
+		//polling an empty socket, leave it off the timeline
+		TRACE_CANCEL(trace);
+		return SOCKET_ERROR;
+	}
+
+	if (m_cipher.enabled()){
+		//decrypt straight into recv_data, a packet that doesn't check out is dropped as if it never came
+		bytecount = m_cipher.open((UINT8 *)recv_data, chunk_size, m_sealed, bytecount);
+		if (bytecount < 0){
+			WSASetLastError(WSAEWOULDBLOCK);
+			return SOCKET_ERROR;
+		}
+	}
+
+
+	return bytecount;
+}
+
+
+
+/*
+Returns the port the last chunk received was sent from
+*/
+u_short Communicator::lastSourcePort(){
+
+	return ntohs(m_source.sin_port);
+}
+
+/*
+Waits up to timeout_ms for data to arrive
+
+Returns 1 if there is data to receive, 0 on timeout or failure
+*/
+int Communicator::waitForData(int timeout_ms){
+
+	fd_set readable;
+	timeval timeout;
+
+	FD_ZERO(&readable);
+	FD_SET(m_partner_socket, &readable);
+	timeout.tv_sec = timeout_ms / 1000;
+	timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+	return (select(0, &readable, NULL, NULL, &timeout) > 0) ? 1 : 0;
+}
+
+/*
+Returns the number of bytes waiting to be received, 0 on failure
+*/
+int Communicator::pendingBytes(){
+
+	u_long pending = 0;
+	if (ioctlsocket(m_partner_socket, FIONREAD, &pending) != 0){
+		return 0;
+	}
+
+	return (int)pending;
+}
+
+/*
+Sends bytes to dest
+*/
+int Communicator::sendUDPChunk(char * chunk, int chunk_size){
+
+	TRACE_SCOPE("send");
+	if (m_cipher.enabled()){
+		if (chunk_size < 0 || chunk_size + (int)CIPHER_OVERHEAD > MAX_PACKET_SIZE){
+			return SOCKET_ERROR;
+		}
+
+		int length = (int)m_cipher.seal(m_sealed, (const UINT8 *)chunk, chunk_size);
+		int sent = sendto(m_partner_socket, (char *)m_sealed, length, 0, (sockaddr *)&m_dest, sizeof(m_dest));
+
+		//callers count the bytes of their own chunk
+		return (sent == length) ? chunk_size : SOCKET_ERROR;
+	}
+
+	return sendto(m_partner_socket, (char *)chunk, chunk_size, 0, (sockaddr *)&m_dest, sizeof(m_dest));
+
+}
+
+/*
+Seals every chunk sent and opens every chunk received with a preshared key, NULL to
+go back to plain UDP
+
+Returns 1 for success, 0 for failure
+*/
+int Communicator::setPresharedKey(const UINT8 * key){
+
+	if (key == NULL){
+		m_cipher.clearKey();
+		return 1;
+	}
+
+	if (m_sealed == NULL){
+		m_sealed = (UINT8 *)malloc(MAX_PACKET_SIZE);
+		if (m_sealed == NULL){
+			return 0;
+		}
+	}
+
+	return m_cipher.setKey(key);
+}
+
+/*
+Returns the number of received packets dropped as forged, corrupted or replayed
+*/
+LONG Communicator::rejectedPackets(){
+
+	return m_cipher.rejectedPackets();
+}
+
+/*
+Returns the MAX_PACKET_SIZE buffer every packet passes through while sealed, NULL
+without a key
+*/
+UINT8 * Communicator::sealedBuffer(){
+
+	return m_cipher.enabled() ? m_sealed : NULL;
 }
\ No newline at end of file
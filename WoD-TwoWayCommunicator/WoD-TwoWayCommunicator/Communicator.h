@@ -1,67 +1,127 @@
-// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
-// Licensed under the BSD 2 - Clause License.
-// See License.txt in the project root for license information.
-
-/**
- * Communicator is a wrapper for setup and management of UDP communication
- **/
-
-#ifndef COMMUNICATOR_H
-#define COMMUNICATOR_H
-
-#include "windows.h"
-
-#define PORT_NUMBER  10001
-
-class Communicator{
-public:
-	Communicator();
-	~Communicator();
-	/*
-	Starts the required Windows conection
-	*/
-	int startWindowsConnection();
-
-	/*
-	Close the windows connection
-	*/
-	int closeWindowsConnection();
-
-	/*
-	Opens a UDP Socket
-	*/
-	int openUDPSocket();
-
-	/*
-	Setup m_server details and bind
-	*/
-	int setupServerAndBind(const char * serv_hostname);
-
-	/*
-	Setup m_dest details
-	*/
-	int setupDestination(const char * dest_hostname);
-
-	/*
-	Receives the 12 bit (formatted as uint16) sample for the ADC from the sender application
-	*/
-	UINT16 receiveSample();
-
-	/*
-	Generates the 12bit sample (formatted as uint 16) from the passed integer and sends it off
-	*/
-	int sendSample(UINT8 p_sample);
-
-	/*
-	Generates the 16bit DAC code (formatted as uint 16) from a passed array of samples and sends it
-	*/
-	int sendUDPChunk(char * p_chunk, int p_chunk_size);
-
-	/*
-	Receives the 16bit DAC command chunk for the DAC from the sender application
-	*/
-	UINT16 receiveUDPChunk(char * recv_data, int p_chunk_size);
-};
-
-
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+ * Communicator is a wrapper for setup and management of UDP communication
+ **/
+
+#ifndef COMMUNICATOR_H
+#define COMMUNICATOR_H
+
+#include "windows.h"
+#include <winsock.h>
+#include "PacketCipher.h"
+
+#define PORT_NUMBER  10001
+
+//largest UDP packet, sealed packets are received here before they are opened
+#define MAX_PACKET_SIZE 65536
+
+class Communicator{
+public:
+	Communicator();
+	~Communicator();
+	/*
+	Starts the required Windows conection
+	*/
+	int startWindowsConnection();
+
+	/*
+	Close the socket and the windows connection, if startWindowsConnection succeeded
+	*/
+	int closeWindowsConnection();
+
+	/*
+	Closes the connection and forgets the addresses, ready to be set up again.
+	The preshared key, if one was set, stays set.
+	*/
+	void reset();
+
+	/*
+	Opens a UDP Socket
+	*/
+	int openUDPSocket();
+
+	/*
+	Setup m_server details and bind, to port unless given
+	*/
+	int setupServerAndBind(const char * serv_hostname, u_short port = PORT_NUMBER);
+
+	/*
+	Setup m_dest details, sending to port unless given
+	*/
+	int setupDestination(const char * dest_hostname, u_short port = PORT_NUMBER);
+
+	/*
+	Receives the 12 bit (formatted as uint16) sample for the ADC from the sender application
+	*/
+	UINT16 receiveSample();
+
+	/*
+	Generates the 12bit sample (formatted as uint 16) from the passed integer and sends it off
+	*/
+	int sendSample(UINT8 p_sample);
+
+	/*
+	Generates the 16bit DAC code (formatted as uint 16) from a passed array of samples and sends it
+	*/
+	int sendUDPChunk(char * p_chunk, int p_chunk_size);
+
+	/*
+	Receives the 16bit DAC command chunk for the DAC from the sender application.
+	Returns the number of bytes received, or SOCKET_ERROR with the reason in WSAGetLastError
+	*/
+	int receiveUDPChunk(char * recv_data, int p_chunk_size);
+
+	/*
+	Returns the port the last chunk received was sent from
+	*/
+	u_short lastSourcePort();
+
+	/*
+	Waits up to timeout_ms for data to arrive, returns 1 if there is data to receive
+	*/
+	int waitForData(int timeout_ms);
+
+	/*
+	Returns the number of bytes waiting to be received
+	*/
+	int pendingBytes();
+
+	/*
+	Seals every chunk sent and opens every chunk received with a preshared key,
+	NULL to go back to plain UDP. Call after setting up the socket.
+	*/
+	int setPresharedKey(const UINT8 * key);
+
+	/*
+	Returns the number of received packets dropped as forged, corrupted or replayed
+	*/
+	LONG rejectedPackets();
+
+	/*
+	Returns the MAX_PACKET_SIZE buffer every packet passes through while sealed, NULL
+	without a key, so the sample loops can lock it in memory with their own buffers
+	*/
+	UINT8 * sealedBuffer();
+
+private:
+	//owns a socket, the sealing buffer and the key state, so it can't be copied
+	Communicator(const Communicator &);
+	Communicator & operator=(const Communicator &);
+
+	SOCKET m_partner_socket;
+	WSADATA m_wsdata;
+	sockaddr_in m_server;
+	sockaddr_in m_dest;
+	sockaddr_in m_source; //sender of the last chunk received
+	const char * m_serv_hostname;
+	const char * m_dest_hostname;
+	PacketCipher m_cipher;
+	UINT8 * m_sealed; //a sealed packet on its way out or in, allocated when a key is set
+	bool m_started; //WSAStartup succeeded and WSACleanup is still owed
+};
+
+
 #endif
\ No newline at end of file
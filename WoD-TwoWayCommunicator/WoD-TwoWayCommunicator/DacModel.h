@@ -0,0 +1,165 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* DacModel describes the Microchip MCP49xx/MCP48xx SPI DACs at compile time, and
+* packs 12 bit samples into the 16 bit command words each part expects
+**/
+
+#ifndef DACMODEL_H
+#define DACMODEL_H
+
+#include "windows.h"
+#include "MCP4921.h"
+
+#define DAC_CHANNEL_A 0
+#define DAC_CHANNEL_B 1
+
+#define DAC_GAIN_1X 1
+#define DAC_GAIN_2X 2
+
+//mid-scale code, the DAC output for silence
+#define DAC_SILENCE 0x800
+
+/*
+	Compile-time descriptor of a DAC in the MCP49xx/MCP48xx family.
+	All of them take a 16 bit word: a 4 bit control nibble followed by 12 data bits,
+	with lower resolution parts ignoring the low data bits.
+
+	@params:
+	Resolution - bits per sample, 8, 10 or 12
+	Channels - 1 for the single parts, 2 for the dual parts
+	ExternalReference - true for the MCP49xx parts with a VREF input and reference buffer,
+		false for the MCP48xx parts with the internal 2.048V reference
+*/
+template <int Resolution, int Channels, bool ExternalReference>
+struct DacModel{
+	static_assert(Resolution == 8 || Resolution == 10 || Resolution == 12, "MCP48xx/49xx parts are 8, 10 or 12 bit");
+	static_assert(Channels == 1 || Channels == 2, "MCP48xx/49xx parts have one or two channels");
+
+	enum {
+		resolution = Resolution,
+		channels = Channels,
+		external_reference = ExternalReference,
+		//12 bit samples are masked down to the bits the part actually converts
+		data_mask = 0x0FFF & ~((1 << (12 - Resolution)) - 1)
+	};
+
+	/*
+		Control nibble for one channel, Buffered is only available with an external reference
+	*/
+	template <int Channel, int Gain, bool Buffered>
+	struct Control{
+		static_assert(Channel < Channels, "channel B only exists on the dual parts");
+		static_assert(Gain == DAC_GAIN_1X || Gain == DAC_GAIN_2X, "gain is 1x or 2x");
+		static_assert(!Buffered || ExternalReference, "only the MCP49xx parts have a reference buffer");
+
+		enum {
+			nibble = (Channel == DAC_CHANNEL_B ? CONFIG_DACB : CONFIG_DACA)
+			| (Buffered ? CONFIG_BUFFERED_OUTPUT : CONFIG_STANDARD_OUTPUT)
+			| (Gain == DAC_GAIN_1X ? CONFIG_1X_GAIN : CONFIG_2X_GAIN)
+			| CONFIG_OUTPUT_ON,
+			word = nibble << 12
+		};
+	};
+};
+
+typedef DacModel<12, 1, true> MCP4921;
+typedef DacModel<12, 2, true> MCP4922;
+typedef DacModel<8, 1, false> MCP4801;
+typedef DacModel<10, 1, false> MCP4811;
+typedef DacModel<12, 1, false> MCP4821;
+typedef DacModel<8, 2, false> MCP4802;
+typedef DacModel<10, 2, false> MCP4812;
+typedef DacModel<12, 2, false> MCP4822;
+
+//the part wired to the SPI bus, pick it with a DAC_xxx preprocessor definition
+#if defined(DAC_MCP4922)
+typedef MCP4922 ActiveDac;
+#elif defined(DAC_MCP4801)
+typedef MCP4801 ActiveDac;
+#elif defined(DAC_MCP4811)
+typedef MCP4811 ActiveDac;
+#elif defined(DAC_MCP4821)
+typedef MCP4821 ActiveDac;
+#elif defined(DAC_MCP4802)
+typedef MCP4802 ActiveDac;
+#elif defined(DAC_MCP4812)
+typedef MCP4812 ActiveDac;
+#elif defined(DAC_MCP4822)
+typedef MCP4822 ActiveDac;
+#else
+typedef MCP4921 ActiveDac;
+#endif
+
+/*
+	Packs 12 bit samples into command words for one channel, high byte first.
+	Unbuffered output at 1x gain, like the original MCP4921 wiring.
+
+	@params:
+	data - storage for the packed bytes, two per sample
+	samples - the 12 bit samples
+	count - the number of samples
+*/
+template <class Model, int Channel>
+inline void packDacChannel(UINT8 * data, const UINT16 * samples, DWORD count)
+{
+	typedef typename Model::template Control<Channel, DAC_GAIN_1X, false> control;
+
+	for (DWORD n = 0, x = 0; x < count; x++){
+		UINT16 word = (UINT16)(control::word | (samples[x] & Model::data_mask));
+		data[n] = (UINT8)(word >> 8);
+		data[n + 1] = (UINT8)(word & 0xFF);
+		n += 2;
+	}
+}
+
+/*
+	Packs two sample streams into one frame per sample period. Dual parts get one word
+	per channel in each frame; single parts get the two streams mixed on channel A.
+	The shorter stream is padded with silence.
+
+	Returns the number of frames packed, data needs 2 * Model::channels bytes per frame
+*/
+template <class Model, int Channels = Model::channels>
+struct DacPairPacker{
+	static DWORD pack(UINT8 * data, const UINT16 * a, DWORD a_count, const UINT16 * b, DWORD b_count)
+	{
+		typedef typename Model::template Control<DAC_CHANNEL_A, DAC_GAIN_1X, false> control;
+		DWORD frames = max(a_count, b_count);
+
+		for (DWORD n = 0, x = 0; x < frames; x++){
+			UINT16 sample_a = (x < a_count) ? a[x] : DAC_SILENCE;
+			UINT16 sample_b = (x < b_count) ? b[x] : DAC_SILENCE;
+			UINT16 word = (UINT16)(control::word | (((sample_a + sample_b) >> 1) & Model::data_mask));
+			data[n] = (UINT8)(word >> 8);
+			data[n + 1] = (UINT8)(word & 0xFF);
+			n += 2;
+		}
+		return frames;
+	}
+};
+
+template <class Model>
+struct DacPairPacker<Model, 2>{
+	static DWORD pack(UINT8 * data, const UINT16 * a, DWORD a_count, const UINT16 * b, DWORD b_count)
+	{
+		typedef typename Model::template Control<DAC_CHANNEL_A, DAC_GAIN_1X, false> control_a;
+		typedef typename Model::template Control<DAC_CHANNEL_B, DAC_GAIN_1X, false> control_b;
+		DWORD frames = max(a_count, b_count);
+
+		for (DWORD n = 0, x = 0; x < frames; x++){
+			UINT16 word_a = (UINT16)(control_a::word | (((x < a_count) ? a[x] : DAC_SILENCE) & Model::data_mask));
+			UINT16 word_b = (UINT16)(control_b::word | (((x < b_count) ? b[x] : DAC_SILENCE) & Model::data_mask));
+			data[n] = (UINT8)(word_a >> 8);
+			data[n + 1] = (UINT8)(word_a & 0xFF);
+			data[n + 2] = (UINT8)(word_b >> 8);
+			data[n + 3] = (UINT8)(word_b & 0xFF);
+			n += 4;
+		}
+		return frames;
+	}
+};
+
+#endif
@@ -0,0 +1,120 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// EchoCanceller.cpp : fixed-point block NLMS echo canceller
+
+#include "EchoCanceller.h"
+#include "Tracer.h"
+
+//12 bit mid-scale, the code for silence on both the DAC and the ADC
+#define ECHO_MIDSCALE 2048
+
+EchoCanceller::EchoCanceller()
+{
+	reset();
+}
+
+EchoCanceller::~EchoCanceller()
+{
+}
+
+/*
+	Forgets the learned echo path and the reference history
+*/
+void EchoCanceller::reset()
+{
+	memset(m_weights, 0, sizeof(m_weights));
+	memset(m_taps, 0, sizeof(m_taps));
+	memset(m_history, 0, sizeof(m_history));
+	memset(m_error, 0, sizeof(m_error));
+	m_energy = 0;
+}
+
+/*
+	Removes the echo of reference from capture, ECHO_BLOCK samples at a time
+*/
+void EchoCanceller::process(const UINT16 * reference, const UINT16 * capture, UINT16 * out, DWORD count)
+{
+	TRACE_SCOPE("echo cancel");
+	for (DWORD n = 0; n < count;)
+	{
+		DWORD block = min(count - n, (DWORD)ECHO_BLOCK);
+
+		//append the block to the reference history, keeping the energy of the newest sample's window current
+		for (DWORD j = 0; j < block; j++)
+		{
+			INT32 x = (INT32)reference[n + j] - ECHO_MIDSCALE;
+			INT32 oldest = m_history[j];
+			m_history[ECHO_TAPS + j] = (INT16)x;
+			m_energy += x * x - oldest * oldest;
+		}
+
+		processBlock(&capture[n], &out[n], block);
+
+		//slide the window along so the newest ECHO_TAPS samples start the history
+		memmove(m_history, &m_history[block], sizeof(INT16)* ECHO_TAPS);
+		n += block;
+	}
+}
+
+/*
+	Filters one block that has been appended to m_history, and adapts if it's a full block
+*/
+void EchoCanceller::processBlock(const UINT16 * capture, UINT16 * out, DWORD count)
+{
+	//filter: estimate the echo for each sample and subtract it
+	for (DWORD j = 0; j < count; j++)
+	{
+		//the ECHO_TAPS samples up to and including this one
+		const INT16 * x = &m_history[j + 1];
+
+		//four independent accumulators keep the multiply pipeline full
+		INT32 acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+		for (int k = 0; k < ECHO_TAPS; k += 4)
+		{
+			acc0 += m_taps[k] * x[k];
+			acc1 += m_taps[k + 1] * x[k + 1];
+			acc2 += m_taps[k + 2] * x[k + 2];
+			acc3 += m_taps[k + 3] * x[k + 3];
+		}
+		INT32 echo = (acc0 + acc1 + acc2 + acc3) >> 15;
+		INT32 error = ((INT32)capture[j] - ECHO_MIDSCALE) - echo;
+
+		m_error[j] = (error > ECHO_ERROR_CLIP) ? ECHO_ERROR_CLIP : ((error < -ECHO_ERROR_CLIP) ? -ECHO_ERROR_CLIP : error);
+
+		error += ECHO_MIDSCALE;
+		out[j] = (UINT16)((error > 4095) ? 4095 : ((error < 0) ? 0 : error));
+	}
+
+	if (count != ECHO_BLOCK || m_energy < ECHO_MIN_ENERGY)
+	{
+		return;
+	}
+
+	/*
+		adapt: w += mu * sum(e[j] * x[j]) / (block * energy)
+		the step is worked out once per block, in Q16, so each tap costs one multiply
+	*/
+	INT64 step = ((INT64)ECHO_STEP << 29) / ((INT64)ECHO_BLOCK * ((INT64)m_energy + ECHO_MIN_ENERGY));
+
+	for (int k = 0; k < ECHO_TAPS; k++)
+	{
+		const INT16 * x = &m_history[k + 1];
+		INT32 gradient = 0;
+		for (int j = 0; j < ECHO_BLOCK; j += 4)
+		{
+			gradient += m_error[j] * x[j]
+				+ m_error[j + 1] * x[j + 1]
+				+ m_error[j + 2] * x[j + 2]
+				+ m_error[j + 3] * x[j + 3];
+		}
+
+		INT64 weight = (INT64)m_weights[k] + (((INT64)gradient * step) >> 16);
+		weight = (weight > 0x7FFFFFFF) ? 0x7FFFFFFF : ((weight < -0x7FFFFFFF) ? -0x7FFFFFFF : weight);
+		m_weights[k] = (INT32)weight;
+
+		INT32 tap = m_weights[k] >> 13;
+		m_taps[k] = (INT16)((tap > 32767) ? 32767 : ((tap < -32768) ? -32768 : tap));
+	}
+}
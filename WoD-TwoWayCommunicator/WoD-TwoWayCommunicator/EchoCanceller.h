@@ -0,0 +1,68 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* EchoCanceller removes the speaker's output from the microphone capture with a
+* fixed-point block NLMS adaptive filter
+**/
+
+#ifndef ECHOCANCELLER_H
+#define ECHOCANCELLER_H
+
+#include "windows.h"
+
+//length of the modelled echo path, 8ms at 16kHz. Must be a multiple of 4
+#define ECHO_TAPS 128
+
+//samples between filter updates. Must be a multiple of 4
+#define ECHO_BLOCK 16
+
+//adaptation step size, Q15
+#define ECHO_STEP 8192
+
+//errors are clipped to this many 12 bit steps while adapting, so near-end speech
+//talking over the far end can't throw the filter far off
+#define ECHO_ERROR_CLIP 512
+
+//don't adapt when the reference energy over the filter window is below this,
+//there is nothing to learn from when the far end is silent
+#define ECHO_MIN_ENERGY (ECHO_TAPS * 16 * 16)
+
+class EchoCanceller{
+public:
+	EchoCanceller();
+	~EchoCanceller();
+
+	/*
+		Forgets the learned echo path and the reference history
+	*/
+	void reset();
+
+	/*
+		Removes the echo of reference from capture. Both are 12 bit unsigned samples
+		covering the same sample periods. Counts that aren't a multiple of ECHO_BLOCK
+		are fine, the leftover samples are filtered without adapting.
+
+		@params:
+		reference - the samples written to the DAC
+		capture - the samples read from the microphone
+		out - storage for the cleaned samples, may be the same array as capture
+		count - the number of samples
+	*/
+	void process(const UINT16 * reference, const UINT16 * capture, UINT16 * out, DWORD count);
+
+private:
+	/*
+		Filters one block that has been appended to m_history, and adapts if it's a full block
+	*/
+	void processBlock(const UINT16 * capture, UINT16 * out, DWORD count);
+
+	INT32 m_weights[ECHO_TAPS]; //Q28 echo path estimate, reversed so filtering walks forwards
+	INT16 m_taps[ECHO_TAPS]; //Q15 copy of m_weights used for filtering
+	INT16 m_history[ECHO_TAPS + ECHO_BLOCK]; //signed reference samples, oldest first, starting with the one that just left the window
+	INT32 m_error[ECHO_BLOCK]; //clipped errors of the current block
+	INT32 m_energy; //reference energy over the last ECHO_TAPS samples
+};
+
+#endif
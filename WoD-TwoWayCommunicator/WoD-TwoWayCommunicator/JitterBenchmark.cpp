@@ -0,0 +1,222 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// JitterBenchmark.cpp : sample lateness under load, with and without the real-time profile
+
+#include "stdafx.h"
+#include "JitterBenchmark.h"
+#include "RealtimeProfile.h"
+
+//sample rate of the loop being measured, the same as the streaming loops
+#define JITTER_SAMPLE_RATE 16000
+
+//bytes written per IO stress pass, and how much is written before rewinding
+#define JITTER_IO_BLOCK (1024 * 1024)
+#define JITTER_IO_FILE_SIZE (64 * 1024 * 1024)
+
+//most stress threads started, one spinner per processor plus the IO thread
+#define JITTER_MAX_THREADS 64
+
+struct JitterResult{
+	double median; //microseconds
+	double p99;
+	double p999;
+	double worst;
+};
+
+//set to stop the stress threads
+static volatile LONG s_stop_stress = 0;
+
+/*
+	Keeps one processor busy until the benchmark ends
+*/
+static DWORD WINAPI cpuStress(LPVOID param)
+{
+	volatile UINT32 value = 1;
+
+	while (s_stop_stress == 0)
+	{
+		for (int n = 0; n < 10000; n++)
+		{
+			value = value * 1664525 + 1013904223;
+		}
+	}
+	return 0;
+}
+
+/*
+	Writes and flushes a file over and over until the benchmark ends
+*/
+static DWORD WINAPI ioStress(LPVOID param)
+{
+	UINT8 * block = (UINT8 *)malloc(JITTER_IO_BLOCK);
+	DWORD written = 0;
+	DWORD position = 0;
+	HANDLE file;
+
+	if (block == NULL)
+	{
+		return 0;
+	}
+	memset(block, 0x55, JITTER_IO_BLOCK);
+
+	file = CreateFile(JITTER_STRESS_FILE, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		free(block);
+		return 0;
+	}
+
+	while (s_stop_stress == 0)
+	{
+		WriteFile(file, block, JITTER_IO_BLOCK, &written, NULL);
+		FlushFileBuffers(file);
+		position += JITTER_IO_BLOCK;
+		if (position >= JITTER_IO_FILE_SIZE)
+		{
+			SetFilePointer(file, 0, NULL, FILE_BEGIN);
+			position = 0;
+		}
+	}
+
+	CloseHandle(file);
+	DeleteFile(JITTER_STRESS_FILE);
+	free(block);
+	return 0;
+}
+
+static int compareLateness(const void * a, const void * b)
+{
+	LONGLONG left = *(const LONGLONG *)a;
+	LONGLONG right = *(const LONGLONG *)b;
+
+	return (left < right) ? -1 : ((left > right) ? 1 : 0);
+}
+
+/*
+	Runs the sample loop for count samples and summarises how late each sample was.
+	The loop busy waits for each deadline, like the streaming loops do, and a sample
+	that is late doesn't move the deadlines of the ones after it.
+
+	@params:
+	profile - the real-time profile, enabled or not
+	lateness - storage for count lateness values, in performance counter ticks
+	count - the number of samples
+	result - the summary, in microseconds
+*/
+static void measureLateness(RealtimeProfile * profile, LONGLONG * lateness, DWORD count, JitterResult * result)
+{
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER start;
+	LARGE_INTEGER now;
+	double to_us;
+
+	QueryPerformanceFrequency(&frequency);
+	to_us = 1000000.0 / (double)frequency.QuadPart;
+
+	profile->lockBuffer(lateness, sizeof(LONGLONG)* count);
+	profile->enterAudioThread();
+
+	QueryPerformanceCounter(&start);
+	for (DWORD n = 0; n < count; n++)
+	{
+		LONGLONG deadline = start.QuadPart + ((LONGLONG)n * frequency.QuadPart) / JITTER_SAMPLE_RATE;
+		do
+		{
+			QueryPerformanceCounter(&now);
+		} while (now.QuadPart < deadline);
+		lateness[n] = now.QuadPart - deadline;
+	}
+
+	profile->leaveAudioThread();
+	profile->unlockBuffer(lateness, sizeof(LONGLONG)* count);
+
+	qsort(lateness, count, sizeof(LONGLONG), compareLateness);
+	result->median = lateness[count / 2] * to_us;
+	result->p99 = lateness[(DWORD)(count * 0.99)] * to_us;
+	result->p999 = lateness[(DWORD)(count * 0.999)] * to_us;
+	result->worst = lateness[count - 1] * to_us;
+}
+
+static void printResult(const char * name, const JitterResult * result)
+{
+	printf("%-12s %10.1f %10.1f %10.1f %10.1f\n", name, result->median, result->p99, result->p999, result->worst);
+}
+
+/*
+	Runs a 16kHz sample loop under a synthetic load, once without the real-time profile
+	and once with it, and prints how late the samples were
+*/
+int RunJitterBenchmark(int seconds)
+{
+	DWORD count = JITTER_SAMPLE_RATE * seconds;
+	LONGLONG * lateness = (LONGLONG *)malloc(sizeof(LONGLONG)* count);
+	HANDLE threads[JITTER_MAX_THREADS];
+	int thread_count = 0;
+	SYSTEM_INFO info;
+	RealtimeProfile profile;
+	JitterResult normal;
+	JitterResult realtime;
+	int succ = 1;
+
+	if (lateness == NULL || count == 0)
+	{
+		free(lateness);
+		return 0;
+	}
+
+	//one spinner per processor, so the CPU the audio loop is pinned to is busy too
+	GetSystemInfo(&info);
+	s_stop_stress = 0;
+	for (DWORD n = 0; n < info.dwNumberOfProcessors && thread_count < JITTER_MAX_THREADS - 1; n++)
+	{
+		threads[thread_count++] = CreateThread(NULL, 0, cpuStress, NULL, 0, NULL);
+	}
+	threads[thread_count++] = CreateThread(NULL, 0, ioStress, NULL, 0, NULL);
+
+	//let the load settle before measuring
+	Sleep(500);
+
+	measureLateness(&profile, lateness, count, &normal);
+
+	/*
+		The priority class is per process, so the stress threads are raised along with
+		the audio loop. They stay below it, which makes this run the harder case of the two.
+	*/
+	if (profile.setEnabled(true))
+	{
+		measureLateness(&profile, lateness, count, &realtime);
+		profile.setEnabled(false);
+	}
+	else
+	{
+		succ = 0;
+	}
+
+	InterlockedExchange(&s_stop_stress, 1);
+	for (int n = 0; n < thread_count; n++)
+	{
+		if (threads[n] != NULL)
+		{
+			WaitForSingleObject(threads[n], INFINITE);
+			CloseHandle(threads[n]);
+		}
+	}
+
+	printf("sample lateness at %dHz over %ds, %d CPU stress threads and 1 IO stress thread, in microseconds\n",
+		JITTER_SAMPLE_RATE, seconds, thread_count - 1);
+	printf("%-12s %10s %10s %10s %10s\n", "profile", "median", "p99", "p99.9", "worst");
+	printResult("normal", &normal);
+	if (succ)
+	{
+		printResult("realtime", &realtime);
+	}
+	else
+	{
+		printf("%-12s could not be enabled\n", "realtime");
+	}
+
+	free(lateness);
+	return succ;
+}
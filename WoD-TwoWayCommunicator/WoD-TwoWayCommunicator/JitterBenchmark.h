@@ -0,0 +1,31 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* JitterBenchmark measures how late a 16kHz sample loop runs while the system is busy,
+* with and without the real-time profile
+**/
+
+#ifndef JITTERBENCHMARK_H
+#define JITTERBENCHMARK_H
+
+#include "windows.h"
+
+//where the IO stress thread writes, deleted when the benchmark ends
+#define JITTER_STRESS_FILE L"C:\\Communicator\\jitter.tmp"
+
+/*
+	Runs a 16kHz sample loop under a synthetic load, a CPU spinner per processor and a
+	thread writing and flushing a file, once without the real-time profile and once with
+	it. Prints the median, 99th, 99.9th percentile and worst lateness of a sample
+	against its deadline for each run.
+
+	@params:
+	seconds - how long each run lasts
+
+	Returns 1 for success, 0 for failure
+*/
+int RunJitterBenchmark(int seconds);
+
+#endif
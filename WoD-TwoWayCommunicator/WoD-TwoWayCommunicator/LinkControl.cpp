@@ -0,0 +1,232 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// LinkControl.cpp : receiver reports and sender rate adaptation
+
+#include "LinkControl.h"
+
+/*
+	Stream settings from the best link to the worst. Smaller frames keep a single loss
+	short and avoid IP fragmentation, 8kHz halves the bitrate, and redundancy lets the
+	receiver conceal a lost frame.
+*/
+struct StreamLevel{
+	UINT32 frame_samples;
+	UINT8 rate_divider;
+	bool redundancy;
+};
+
+static const StreamLevel s_levels[] = {
+	{ 16000, 1, false }, //1s frames, the original stream
+	{ 1600, 1, false }, //100ms
+	{ 640, 1, true }, //40ms with redundancy
+	{ 640, 2, true }, //40ms at 8kHz with redundancy
+	{ 320, 2, true } //20ms at 8kHz with redundancy
+};
+
+#define LINK_LEVEL_COUNT (sizeof(s_levels) / sizeof(s_levels[0]))
+
+//new streams start on 100ms frames rather than the 1s ones
+#define LINK_START_LEVEL 1
+
+/*
+	Returns the local sample clock, STREAM_CLOCK_RATE ticks per second
+*/
+UINT32 streamClock()
+{
+	static LARGE_INTEGER frequency = { 0 };
+	LARGE_INTEGER now;
+
+	if (frequency.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&frequency);
+	}
+	QueryPerformanceCounter(&now);
+
+	return (UINT32)((now.QuadPart * STREAM_CLOCK_RATE) / frequency.QuadPart);
+}
+
+LinkMonitor::LinkMonitor()
+{
+	reset();
+}
+
+/*
+	Forgets the stream, the next frame starts a new one
+*/
+void LinkMonitor::reset()
+{
+	m_started = false;
+	m_base_sequence = 0;
+	m_highest_sequence = 0;
+	m_received = 0;
+	m_expected_prior = 0;
+	m_received_prior = 0;
+	m_last_transit = 0;
+	m_jitter = 0;
+	m_last_report = 0;
+	m_frames_since_report = 0;
+}
+
+/*
+	Records the arrival of an audio frame
+
+	Returns the number of frames lost right before this one, or -1 if the frame
+	should be dropped
+*/
+int LinkMonitor::onFrame(const AudioFrameHeader * header, UINT32 arrival)
+{
+	INT32 delta = (INT32)(header->sequence - m_highest_sequence);
+	INT32 transit = (INT32)(arrival - header->timestamp);
+
+	if (!m_started || delta > LINK_RESTART_GAP || delta < -LINK_RESTART_GAP)
+	{
+		reset();
+		m_started = true;
+		m_base_sequence = header->sequence;
+		m_highest_sequence = header->sequence;
+		m_received = 1;
+		m_last_transit = transit;
+		m_last_report = arrival;
+		m_frames_since_report = 1;
+		return 0;
+	}
+
+	if (delta <= 0)
+	{
+		return -1;
+	}
+
+	m_highest_sequence = header->sequence;
+	m_received++;
+	m_frames_since_report++;
+
+	//RFC 3550 interarrival jitter, J += (|D| - J) / 16
+	INT32 difference = transit - m_last_transit;
+	m_last_transit = transit;
+	if (difference < 0)
+	{
+		difference = -difference;
+	}
+	m_jitter += difference - ((m_jitter + 8) >> 4);
+
+	return delta - 1;
+}
+
+/*
+	Returns 1 if a report should be sent, 0 otherwise
+*/
+int LinkMonitor::reportDue(UINT32 now)
+{
+	return (m_frames_since_report > 0 && (UINT32)(now - m_last_report) >= LINK_REPORT_INTERVAL) ? 1 : 0;
+}
+
+/*
+	Fills in a report covering the frames since the last one
+*/
+void LinkMonitor::buildReport(ReceiverReport * report, UINT16 buffer_depth, UINT32 now)
+{
+	UINT32 expected = m_highest_sequence - m_base_sequence + 1;
+	UINT32 expected_interval = expected - m_expected_prior;
+	UINT32 received_interval = m_received - m_received_prior;
+	UINT32 fraction = 0;
+
+	if (expected_interval > received_interval)
+	{
+		fraction = ((expected_interval - received_interval) << 8) / expected_interval;
+	}
+
+	report->type = STREAM_PACKET_REPORT;
+	report->loss_fraction = (UINT8)((fraction > 255) ? 255 : fraction);
+	report->buffer_depth = buffer_depth;
+	report->highest_sequence = m_highest_sequence;
+	report->jitter = m_jitter >> 4;
+
+	m_expected_prior = expected;
+	m_received_prior = m_received;
+	m_last_report = now;
+	m_frames_since_report = 0;
+}
+
+RateController::RateController()
+{
+	reset();
+}
+
+/*
+	Goes back to the starting level
+*/
+void RateController::reset()
+{
+	m_level = LINK_START_LEVEL;
+	m_clean_reports = 0;
+	m_change_sequence = 0;
+}
+
+/*
+	Adapts to a report from the receiver
+*/
+void RateController::onReport(const ReceiverReport * report, UINT32 next_sequence)
+{
+	//the report covers frames sent before the last change, it says nothing about this level
+	if ((INT32)(report->highest_sequence - m_change_sequence) < 0)
+	{
+		return;
+	}
+
+	bool bad = report->loss_fraction >= LINK_BAD_LOSS
+		|| report->buffer_depth > LINK_BAD_DEPTH_MS
+		|| report->jitter > LINK_BAD_JITTER;
+	bool clean = report->loss_fraction == 0
+		&& report->buffer_depth < LINK_CLEAN_DEPTH_MS
+		&& report->jitter < LINK_CLEAN_JITTER;
+
+	if (bad)
+	{
+		m_clean_reports = 0;
+		if (m_level + 1 < (int)LINK_LEVEL_COUNT)
+		{
+			m_level++;
+			m_change_sequence = next_sequence;
+		}
+	}
+	else if (clean)
+	{
+		m_clean_reports++;
+		if (m_clean_reports >= LINK_CLEAN_REPORTS && m_level > 0)
+		{
+			m_level--;
+			m_clean_reports = 0;
+			m_change_sequence = next_sequence;
+		}
+	}
+	else
+	{
+		m_clean_reports = 0;
+	}
+}
+
+/*
+	Samples to capture per frame, at 16kHz
+*/
+UINT32 RateController::frameSamples()
+{
+	return s_levels[m_level].frame_samples;
+}
+
+/*
+	1 to send at 16kHz, 2 to send at 8kHz
+*/
+UINT8 RateController::rateDivider()
+{
+	return s_levels[m_level].rate_divider;
+}
+
+/*
+	true if frames should carry a copy of the previous frame
+*/
+bool RateController::redundancy()
+{
+	return s_levels[m_level].redundancy;
+}
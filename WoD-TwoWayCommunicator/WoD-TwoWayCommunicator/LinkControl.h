@@ -0,0 +1,136 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* LinkControl measures how a stream is arriving at the receiver, and adapts how the
+* sender streams from the receiver's reports
+**/
+
+#ifndef LINKCONTROL_H
+#define LINKCONTROL_H
+
+#include "windows.h"
+#include "StreamProtocol.h"
+
+//how often the receiver reports, in sample clock ticks (500ms)
+#define LINK_REPORT_INTERVAL 8000
+
+//a sequence jump bigger than this means the sender restarted
+#define LINK_RESTART_GAP 1000
+
+//a report is bad if any of these are exceeded
+#define LINK_BAD_LOSS 5 //out of 256, about 2%
+#define LINK_BAD_DEPTH_MS 250
+#define LINK_BAD_JITTER 640 //40ms
+
+//a report is clean if all of these are met
+#define LINK_CLEAN_DEPTH_MS 100
+#define LINK_CLEAN_JITTER 320 //20ms
+
+//clean reports in a row needed before stepping back up
+#define LINK_CLEAN_REPORTS 4
+
+/*
+	Returns the local sample clock, STREAM_CLOCK_RATE ticks per second
+*/
+UINT32 streamClock();
+
+/*
+	Receiver side: tracks loss and jitter of the incoming frames, RTP style
+*/
+class LinkMonitor{
+public:
+	LinkMonitor();
+
+	/*
+		Forgets the stream, the next frame starts a new one
+	*/
+	void reset();
+
+	/*
+		Records the arrival of an audio frame
+
+		@params:
+		header - the header of the frame
+		arrival - the sample clock when the frame arrived
+
+		Returns the number of frames lost right before this one, or -1 if the frame is
+		a duplicate or arrived after a later frame and should be dropped
+	*/
+	int onFrame(const AudioFrameHeader * header, UINT32 arrival);
+
+	/*
+		Returns 1 if a report should be sent, 0 otherwise
+	*/
+	int reportDue(UINT32 now);
+
+	/*
+		Fills in a report covering the frames since the last one
+
+		@params:
+		report - the report to fill in
+		buffer_depth - milliseconds of audio waiting in the receive buffer
+		now - the sample clock
+	*/
+	void buildReport(ReceiverReport * report, UINT16 buffer_depth, UINT32 now);
+
+private:
+	bool m_started;
+	UINT32 m_base_sequence; //first sequence number of the stream
+	UINT32 m_highest_sequence;
+	UINT32 m_received; //frames received since the stream started
+	UINT32 m_expected_prior; //frames expected at the last report
+	UINT32 m_received_prior; //frames received at the last report
+	INT32 m_last_transit; //arrival minus timestamp of the last frame
+	UINT32 m_jitter; //interarrival jitter, scaled by 16
+	UINT32 m_last_report; //sample clock of the last report
+	UINT32 m_frames_since_report;
+};
+
+/*
+	Sender side: steps along a ladder of stream settings, from large frames at 16kHz for
+	a clean link to small 8kHz frames with redundancy for a congested or lossy one
+*/
+class RateController{
+public:
+	RateController();
+
+	/*
+		Goes back to the starting level
+	*/
+	void reset();
+
+	/*
+		Adapts to a report from the receiver. Steps down a level on a bad report, and up
+		a level after LINK_CLEAN_REPORTS clean ones. Reports covering frames sent before
+		the last change are ignored.
+
+		@params:
+		report - the report from the receiver
+		next_sequence - the sequence number of the next frame to be sent
+	*/
+	void onReport(const ReceiverReport * report, UINT32 next_sequence);
+
+	/*
+		Samples to capture per frame, at 16kHz
+	*/
+	UINT32 frameSamples();
+
+	/*
+		1 to send at 16kHz, 2 to send at 8kHz
+	*/
+	UINT8 rateDivider();
+
+	/*
+		true if frames should carry a copy of the previous frame
+	*/
+	bool redundancy();
+
+private:
+	int m_level;
+	int m_clean_reports;
+	UINT32 m_change_sequence; //first frame sent with the current level
+};
+
+#endif
@@ -0,0 +1,476 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// LoadGenerator.cpp : many virtual communicators streaming to one receiver
+
+#include "stdafx.h"
+#include "LoadGenerator.h"
+#include "Communicator.h"
+#include "StreamProtocol.h"
+
+#include <math.h>
+
+#define LOAD_PI 3.14159265358979323846
+
+//synthetic speech the virtual communicators loop over, 1s at 16kHz, a whole number of frames
+#define LOAD_SPEECH_SAMPLES 16000
+
+//send times kept per stream, to match received frames against
+#define LOAD_HISTORY 64
+
+//most threads sending frames, each looks after a slice of the streams
+#define LOAD_SENDER_THREADS 4
+
+//how long the receiver waits for a packet before checking whether to stop
+#define LOAD_RECEIVE_TIMEOUT_MS 10
+
+//how long the socket has to stay quiet after the senders stop before the receiver stops,
+//so frames still in flight are counted as received rather than lost
+#define LOAD_DRAIN_TIMEOUT_MS 100
+
+/*
+	One simulated communicator
+*/
+struct VirtualCommunicator{
+	Communicator communicator;
+	volatile LONG sequence; //sequence number of the next frame, read by the receiver
+	UINT32 random; //state of the talk and silence generator
+	bool talking;
+	LONGLONG next_frame; //performance counter time the next frame is due
+	LONGLONG switch_time; //performance counter time the talkspurt or silence ends
+	DWORD speech_pos; //where in the synthetic speech the next frame starts
+	DWORD previous_pos; //where the last frame sent started, -1 after a silence
+	volatile LONG send_times[LOAD_HISTORY]; //microseconds after the start when each recent frame was sent, by sequence number
+	LONG sent;
+	LONG received;
+};
+
+/*
+	State shared by the sender and receiver threads of one step
+*/
+struct LoadRun{
+	VirtualCommunicator * streams;
+	int stream_count;
+	LONGLONG frequency;
+	LONGLONG origin; //performance counter when the streams started
+	volatile LONG stop; //tells the senders to stop
+	volatile LONG senders_done; //the senders have stopped, the receiver reads what is left
+
+	//filled in by the receiver
+	Communicator receiver;
+	UINT32 * latencies; //microseconds
+	DWORD latency_capacity;
+	DWORD latency_count;
+	LONGLONG bytes_received;
+};
+
+struct SenderSlice{
+	LoadRun * run;
+	int first;
+	int count;
+};
+
+static UINT16 s_speech[LOAD_SPEECH_SAMPLES];
+
+/*
+	Fills s_speech with a voiced sound: a 150Hz pitch with its harmonics rolling off,
+	syllable rate amplitude changes, and a little noise
+*/
+static void makeSpeech()
+{
+	UINT32 random = 12345;
+
+	for (int n = 0; n < LOAD_SPEECH_SAMPLES; n++)
+	{
+		double t = (double)n / STREAM_CLOCK_RATE;
+		double value = 0;
+
+		for (int h = 1; h <= 20; h++)
+		{
+			value += sin(2 * LOAD_PI * 150 * h * t) / h;
+		}
+		value *= 0.5 + 0.5 * sin(2 * LOAD_PI * 4 * t);
+
+		random = random * 1664525 + 1013904223;
+		value += ((INT32)(random >> 16) - 32768) / 327680.0;
+
+		s_speech[n] = (UINT16)(2048 + 600 * value);
+	}
+}
+
+/*
+	Returns a random time, exponentially distributed around mean_ms, in performance counter ticks
+*/
+static LONGLONG randomDuration(UINT32 * random, int mean_ms, LONGLONG frequency)
+{
+	*random = *random * 1664525 + 1013904223;
+	double uniform = ((*random >> 8) + 1) / 16777217.0;
+
+	return (LONGLONG)(-log(uniform) * mean_ms * frequency / 1000);
+}
+
+/*
+	Sends the frames of a slice of the virtual communicators as they fall due
+*/
+static DWORD WINAPI senderThread(LPVOID param)
+{
+	SenderSlice * slice = (SenderSlice *)param;
+	LoadRun * run = slice->run;
+	LONGLONG frame_ticks = run->frequency * LOAD_FRAME_SAMPLES / STREAM_CLOCK_RATE;
+	UINT8 packet[sizeof(AudioFrameHeader) + 4 * LOAD_FRAME_SAMPLES];
+	LARGE_INTEGER now;
+
+	while (run->stop == 0)
+	{
+		QueryPerformanceCounter(&now);
+
+		for (int s = slice->first; s < slice->first + slice->count; s++)
+		{
+			VirtualCommunicator * stream = &run->streams[s];
+
+			if (now.QuadPart < stream->next_frame)
+			{
+				continue;
+			}
+			stream->next_frame += frame_ticks;
+
+			//after a long stall start afresh rather than sending a burst
+			if (stream->next_frame < now.QuadPart - 5 * frame_ticks)
+			{
+				stream->next_frame = now.QuadPart + frame_ticks;
+			}
+
+			if (now.QuadPart >= stream->switch_time)
+			{
+				stream->talking = !stream->talking;
+				stream->switch_time = now.QuadPart + randomDuration(&stream->random,
+					stream->talking ? LOAD_TALK_MS : LOAD_SILENCE_MS, run->frequency);
+				stream->previous_pos = (DWORD)-1;
+			}
+			if (!stream->talking)
+			{
+				continue;
+			}
+
+			const UINT16 * previous = (stream->previous_pos == (DWORD)-1) ? NULL : &s_speech[stream->previous_pos];
+			DWORD length = encodeAudioFrame(packet, (UINT32)stream->sequence, (UINT32)(now.QuadPart * STREAM_CLOCK_RATE / run->frequency),
+				&s_speech[stream->speech_pos], LOAD_FRAME_SAMPLES, 1, previous, LOAD_FRAME_SAMPLES);
+
+			stream->previous_pos = stream->speech_pos;
+			stream->speech_pos = (stream->speech_pos + LOAD_FRAME_SAMPLES) % LOAD_SPEECH_SAMPLES;
+
+			/*
+				The receiver reads these as the frames arrive. 32 bit values written with
+				InterlockedExchange can't be torn, and the sequence number is published
+				after the send time, so the receiver never matches a frame to a stale time.
+			*/
+			LARGE_INTEGER sent;
+			QueryPerformanceCounter(&sent);
+			InterlockedExchange(&stream->send_times[(UINT32)stream->sequence % LOAD_HISTORY],
+				(LONG)((sent.QuadPart - run->origin) * 1000000 / run->frequency));
+			InterlockedExchange(&stream->sequence, stream->sequence + 1);
+
+			if (stream->communicator.sendUDPChunk((char *)packet, length) == (int)length)
+			{
+				stream->sent++;
+			}
+		}
+
+		//frames are due every 20ms, there is no point spinning for them
+		Sleep(1);
+	}
+
+	return 0;
+}
+
+/*
+	Receives the frames of every virtual communicator on one socket, unpacks them the
+	way StreamInAnalog does and records how long each took to arrive. Once the senders
+	are done it keeps reading until the socket has been quiet for LOAD_DRAIN_TIMEOUT_MS.
+*/
+static DWORD WINAPI receiverThread(LPVOID param)
+{
+	LoadRun * run = (LoadRun *)param;
+	UINT8 packet[sizeof(AudioFrameHeader) + 4 * LOAD_FRAME_SAMPLES];
+	UINT8 words[8 * LOAD_FRAME_SAMPLES];
+	LARGE_INTEGER now;
+
+	while (true)
+	{
+		bool draining = run->senders_done != 0;
+
+		if (run->receiver.waitForData(draining ? LOAD_DRAIN_TIMEOUT_MS : LOAD_RECEIVE_TIMEOUT_MS) == 0)
+		{
+			if (draining)
+			{
+				break;
+			}
+			continue;
+		}
+
+		while (true)
+		{
+			int x = run->receiver.receiveUDPChunk((char *)packet, sizeof(packet));
+			if (x == SOCKET_ERROR)
+			{
+				break;
+			}
+			QueryPerformanceCounter(&now);
+
+			int s = run->receiver.lastSourcePort() - LOAD_BASE_PORT - 1;
+			if (s < 0 || s >= run->stream_count)
+			{
+				continue;
+			}
+			if (decodeAudioFrame(packet, x, false, words, sizeof(words)) == 0)
+			{
+				continue;
+			}
+
+			VirtualCommunicator * stream = &run->streams[s];
+			UINT32 sequence = ((AudioFrameHeader *)packet)->sequence;
+			stream->received++;
+			run->bytes_received += x;
+
+			//frames older than the history can't be matched to a send time
+			if ((UINT32)stream->sequence - sequence >= LOAD_HISTORY || run->latency_count >= run->latency_capacity)
+			{
+				continue;
+			}
+			LONG sent = stream->send_times[sequence % LOAD_HISTORY];
+
+			//the sender may have reused the slot for a later frame while it was read
+			MemoryBarrier();
+			if ((UINT32)stream->sequence - sequence >= LOAD_HISTORY)
+			{
+				continue;
+			}
+			LONG arrived = (LONG)((now.QuadPart - run->origin) * 1000000 / run->frequency);
+			run->latencies[run->latency_count++] = (UINT32)(arrived - sent);
+		}
+	}
+
+	return 0;
+}
+
+static int compareLatency(const void * a, const void * b)
+{
+	UINT32 left = *(const UINT32 *)a;
+	UINT32 right = *(const UINT32 *)b;
+
+	return (left < right) ? -1 : ((left > right) ? 1 : 0);
+}
+
+/*
+	Returns a FILETIME as a count of 100ns units
+*/
+static LONGLONG fileTimeTicks(const FILETIME & time)
+{
+	return ((LONGLONG)time.dwHighDateTime << 32) | time.dwLowDateTime;
+}
+
+/*
+	Returns the user and kernel time used by the process, in 100ns units
+*/
+static LONGLONG processTime()
+{
+	FILETIME creation, exit, kernel, user;
+
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+	return fileTimeTicks(kernel) + fileTimeTicks(user);
+}
+
+/*
+	Returns the user and kernel time used by a thread, in 100ns units
+*/
+static LONGLONG threadTime(HANDLE thread)
+{
+	FILETIME creation, exit, kernel, user;
+
+	GetThreadTimes(thread, &creation, &exit, &kernel, &user);
+	return fileTimeTicks(kernel) + fileTimeTicks(user);
+}
+
+/*
+	Runs stream_count virtual communicators for seconds and prints one row of results
+
+	Returns 1 for success, 0 if the sockets couldn't be set up
+*/
+static int runStep(const char * hostname, int stream_count, int seconds)
+{
+	LoadRun run;
+	SenderSlice slices[LOAD_SENDER_THREADS];
+	HANDLE senders[LOAD_SENDER_THREADS];
+	HANDLE receiver;
+	int sender_count = 0;
+	int ready = 0;
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER start;
+	LARGE_INTEGER end;
+	LONGLONG process_start;
+	LONGLONG receiver_time;
+
+	QueryPerformanceFrequency(&frequency);
+	run.frequency = frequency.QuadPart;
+	run.stop = 0;
+	run.senders_done = 0;
+	run.stream_count = stream_count;
+	run.latency_count = 0;
+	run.bytes_received = 0;
+	run.latency_capacity = stream_count * seconds * (STREAM_CLOCK_RATE / LOAD_FRAME_SAMPLES);
+	run.latencies = (UINT32 *)malloc(sizeof(UINT32)* run.latency_capacity);
+	run.streams = new VirtualCommunicator[stream_count];
+	if (run.latencies == NULL)
+	{
+		delete[] run.streams;
+		return 0;
+	}
+
+	//the receiver, then one socket per virtual communicator all sending to it
+	run.receiver.startWindowsConnection();
+	if (run.receiver.openUDPSocket() == 1 && run.receiver.setupServerAndBind(hostname, LOAD_BASE_PORT))
+	{
+		ready = 1;
+	}
+
+	QueryPerformanceCounter(&start);
+	for (int s = 0; s < stream_count && ready; s++)
+	{
+		VirtualCommunicator * stream = &run.streams[s];
+
+		stream->communicator.startWindowsConnection();
+		if (stream->communicator.openUDPSocket() != 1
+			|| !stream->communicator.setupServerAndBind(hostname, (u_short)(LOAD_BASE_PORT + 1 + s))
+			|| !stream->communicator.setupDestination(hostname, LOAD_BASE_PORT))
+		{
+			ready = 0;
+		}
+
+		stream->sequence = 0;
+		stream->random = 2654435761U * (s + 1);
+		stream->speech_pos = ((s * 7) % (LOAD_SPEECH_SAMPLES / LOAD_FRAME_SAMPLES)) * LOAD_FRAME_SAMPLES;
+		stream->previous_pos = (DWORD)-1;
+		stream->sent = 0;
+		stream->received = 0;
+
+		//spread frame times and start half the streams talking, so they don't all start in step
+		stream->next_frame = start.QuadPart + (run.frequency * LOAD_FRAME_SAMPLES / STREAM_CLOCK_RATE) * s / stream_count;
+		stream->talking = (s & 1) == 0;
+		stream->switch_time = start.QuadPart + randomDuration(&stream->random,
+			stream->talking ? LOAD_TALK_MS : LOAD_SILENCE_MS, run.frequency);
+	}
+
+	if (ready)
+	{
+		process_start = processTime();
+		QueryPerformanceCounter(&start);
+		run.origin = start.QuadPart;
+
+		receiver = CreateThread(NULL, 0, receiverThread, &run, 0, NULL);
+		for (int t = 0; t < LOAD_SENDER_THREADS && t < stream_count; t++)
+		{
+			int per_thread = (stream_count + LOAD_SENDER_THREADS - 1) / LOAD_SENDER_THREADS;
+			slices[t].run = &run;
+			slices[t].first = t * per_thread;
+			slices[t].count = min(per_thread, stream_count - slices[t].first);
+			if (slices[t].count > 0)
+			{
+				senders[sender_count++] = CreateThread(NULL, 0, senderThread, &slices[t], 0, NULL);
+			}
+		}
+
+		Sleep(seconds * 1000);
+
+		//stop the senders first, then let the receiver take the frames still on their way
+		InterlockedExchange(&run.stop, 1);
+		for (int t = 0; t < sender_count; t++)
+		{
+			WaitForSingleObject(senders[t], INFINITE);
+			CloseHandle(senders[t]);
+		}
+		InterlockedExchange(&run.senders_done, 1);
+		WaitForSingleObject(receiver, INFINITE);
+		QueryPerformanceCounter(&end);
+		receiver_time = threadTime(receiver);
+		CloseHandle(receiver);
+
+		double elapsed = (double)(end.QuadPart - start.QuadPart) / run.frequency;
+		double process_cpu = (processTime() - process_start) / (elapsed * 100000.0); //percent of one CPU
+		double receiver_cpu = receiver_time / (elapsed * 100000.0);
+		LONGLONG sent = 0;
+		LONGLONG received = 0;
+
+		for (int s = 0; s < stream_count; s++)
+		{
+			sent += run.streams[s].sent;
+			received += run.streams[s].received;
+		}
+
+		qsort(run.latencies, run.latency_count, sizeof(UINT32), compareLatency);
+		UINT32 p50 = 0, p99 = 0, p999 = 0, worst = 0;
+		if (run.latency_count > 0)
+		{
+			p50 = run.latencies[run.latency_count / 2];
+			p99 = run.latencies[(DWORD)(run.latency_count * 0.99)];
+			p999 = run.latencies[(DWORD)(run.latency_count * 0.999)];
+			worst = run.latencies[run.latency_count - 1];
+		}
+
+		printf("%7d %9.0f %8.2f %8.0f %8u %8u %8u %8u %9.3f %9.3f\n",
+			stream_count,
+			run.bytes_received * 8 / elapsed / 1000,
+			(sent > 0) ? 100.0 * (sent - received) / sent : 0.0,
+			received / elapsed,
+			p50, p99, p999, worst,
+			process_cpu / stream_count,
+			receiver_cpu / stream_count);
+	}
+
+	for (int s = 0; s < stream_count; s++)
+	{
+		run.streams[s].communicator.closeWindowsConnection();
+	}
+	run.receiver.closeWindowsConnection();
+
+	delete[] run.streams;
+	free(run.latencies);
+	return ready;
+}
+
+/*
+	Streams framed audio from virtual communicators to a receiver in the same process,
+	doubling the number of streams up to max_streams
+
+	Returns 1 for success, 0 for failure
+*/
+int RunLoadGenerator(const char * hostname, int max_streams, int seconds)
+{
+	if (max_streams < 1 || max_streams > LOAD_MAX_STREAMS || seconds < 1)
+	{
+		return 0;
+	}
+
+	makeSpeech();
+
+	printf("%d virtual communicators at most, %dms frames, talking %dms and silent %dms on average, %ds per step\n",
+		max_streams, 1000 * LOAD_FRAME_SAMPLES / STREAM_CLOCK_RATE, LOAD_TALK_MS, LOAD_SILENCE_MS, seconds);
+	printf("%7s %9s %8s %8s %8s %8s %8s %8s %9s %9s\n",
+		"streams", "kbit/s", "loss %", "frames/s", "p50 us", "p99 us", "p99.9 us", "worst us", "cpu %/st", "rx %/st");
+
+	for (int streams = 1; ; streams *= 2)
+	{
+		streams = min(streams, max_streams);
+		if (!runStep(hostname, streams, seconds))
+		{
+			printf("could not set up %d streams\n", streams);
+			return 0;
+		}
+		if (streams == max_streams)
+		{
+			break;
+		}
+	}
+
+	return 1;
+}
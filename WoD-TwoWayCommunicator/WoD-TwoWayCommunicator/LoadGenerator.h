@@ -0,0 +1,43 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* LoadGenerator simulates many communicators streaming to one receiver, to find how
+* many concurrent streams a receiver can take
+**/
+
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include "windows.h"
+
+//the receiver listens on this port, virtual communicator n sends from LOAD_BASE_PORT + 1 + n
+#define LOAD_BASE_PORT 20000
+
+#define LOAD_MAX_STREAMS 1024
+
+//20ms frames at 16kHz, sent with a redundant copy of the previous one
+#define LOAD_FRAME_SAMPLES 320
+
+//mean length of a talkspurt and of the silence after it, nothing is sent while silent
+#define LOAD_TALK_MS 1000
+#define LOAD_SILENCE_MS 1350
+
+/*
+	Streams framed audio from virtual communicators to a receiver in the same process,
+	each on its own Communicator and socket, with talkspurts and silences. Starts with
+	one stream and doubles up to max_streams, printing for each step the delivered
+	throughput and loss, the send to receive latency percentiles, and the CPU used per
+	stream, by the whole process and by the receiver alone.
+
+	@params:
+	hostname - the host to bind the sockets to and stream to, usually this machine
+	max_streams - the most virtual communicators, at most LOAD_MAX_STREAMS
+	seconds - how long each step lasts
+
+	Returns 1 for success, 0 for failure
+*/
+int RunLoadGenerator(const char * hostname, int max_streams, int seconds);
+
+#endif
@@ -1,72 +1,147 @@
-// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
-// Licensed under the BSD 2 - Clause License.
-// See License.txt in the project root for license information.
-
-
-// Main.cpp : Defines the entry point for the console application.
-//
-
-#include "stdafx.h"
-#include "RawAudio.h"
-#include "arduino.h"
-
-#define DAC_CS_PIN 2
-#define CONTROL_BUTTON 3
-#define READY_LED 4
-#define MICROPHONE_INPUT A0
-
-#define COMMUNICATOR_ONE_NAME L"CommunicatorOne"
-#define COMMUNICATOR_TWO_NAME L"CommunicatorTwo"
-
-void setup()
-{
-	pinMode(READY_LED, OUTPUT);
-	digitalWrite(READY_LED, 0);
-	pinMode(CONTROL_BUTTON, INPUT);
-}
-
-int _tmain(int argc, _TCHAR* argv[])
-{
-	setup();
-
-	//Prepare Audio Manager
-	RawAudio audio_manager = RawAudio();
-
-	//setup destination location
-	//get the computer name
-	DWORD name_length = MAX_COMPUTERNAME_LENGTH + 1;
-	LPWSTR computer_name = (LPWSTR)malloc(MAX_COMPUTERNAME_LENGTH + 1);
-	GetComputerNameEx(ComputerNameDnsHostname, computer_name, &name_length);
-
-	/* Determine the transmitter and receiver by comparing this computer's
-	   name with communicator names */
-	if (wcscmp(computer_name, COMMUNICATOR_ONE_NAME) == 0)
-	{
-		audio_manager.SetupStream("CommunicatorOne", "CommunicatorTwo");
-	}
-	else
-	{
-		audio_manager.SetupStream("CommunicatorTwo", "CommunicatorOne");
-	}
-
-	//Play startup noise, set Ready Light on
-	audio_manager.PlayWavFile(L"C:\\Communicator\\aud\\ready.wav", DAC_CS_PIN);
-	digitalWrite(READY_LED, 1);
-
-	while (true)
-	{
-		if (digitalRead(CONTROL_BUTTON) == 1)
-		{
-			//stream out when the button is pressed, in 1 second clips
-			audio_manager.StreamOutAnalog(DAC_CS_PIN, MICROPHONE_INPUT, CONTROL_BUTTON, 1);
-		}
-		else
-		{
-			//stream in 1 second clips
-			audio_manager.StreamInAnalog(DAC_CS_PIN, CONTROL_BUTTON, 1);
-		}
-	}
-
-
-
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+
+// Main.cpp : Defines the entry point for the console application.
+//
+
+#include "stdafx.h"
+#include "RawAudio.h"
+#include "JitterBenchmark.h"
+#include "LoadGenerator.h"
+#include "CipherBenchmark.h"
+#include "Tracer.h"
+#include "arduino.h"
+
+#define DAC_CS_PIN 2
+#define CONTROL_BUTTON 3
+#define READY_LED 4
+#define MICROPHONE_INPUT A0
+
+#define COMMUNICATOR_ONE_NAME L"CommunicatorOne"
+#define COMMUNICATOR_TWO_NAME L"CommunicatorTwo"
+
+#if defined(RECORD_AUDIO) || defined(ENABLE_TRACE)
+static RawAudio * s_audio_manager = NULL;
+
+/*
+	Finishes the recording and the trace file when the program is stopped with Ctrl+C
+	or its console is closed, the ways the communicator exits, so the last segment
+	keeps its newest audio and the JSON array gets its closing bracket
+*/
+BOOL WINAPI finishLogs(DWORD ctrl_type)
+{
+#ifdef RECORD_AUDIO
+	s_audio_manager->StopRecording();
+#endif
+#ifdef ENABLE_TRACE
+	Tracer::stop();
+#endif
+
+	//carry on to the default handler, which ends the process
+	return FALSE;
+}
+#endif
+
+void setup()
+{
+	pinMode(READY_LED, OUTPUT);
+	digitalWrite(READY_LED, 0);
+	pinMode(CONTROL_BUTTON, INPUT);
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	setup();
+
+#ifdef RUN_JITTER_BENCHMARK
+	//measure sample lateness under load with and without the real-time profile, then exit
+	return RunJitterBenchmark(10) ? 0 : 1;
+#endif
+
+#ifdef RUN_LOAD_GENERATOR
+	//stream from up to 256 virtual communicators to a receiver on this machine, then exit
+	return RunLoadGenerator("localhost", 256, 10) ? 0 : 1;
+#endif
+
+#ifdef RUN_CIPHER_BENCHMARK
+	//measure what encrypting the stream costs per frame, then exit
+	return RunCipherBenchmark(3) ? 0 : 1;
+#endif
+
+	//Prepare Audio Manager
+	RawAudio audio_manager;
+
+	//setup destination location
+	//get the computer name
+	DWORD name_length = MAX_COMPUTERNAME_LENGTH + 1;
+	LPWSTR computer_name = (LPWSTR)malloc(MAX_COMPUTERNAME_LENGTH + 1);
+	GetComputerNameEx(ComputerNameDnsHostname, computer_name, &name_length);
+
+	/* Determine the transmitter and receiver by comparing this computer's
+	   name with communicator names */
+	if (wcscmp(computer_name, COMMUNICATOR_ONE_NAME) == 0)
+	{
+		audio_manager.SetupStream("CommunicatorOne", "CommunicatorTwo");
+	}
+	else
+	{
+		audio_manager.SetupStream("CommunicatorTwo", "CommunicatorOne");
+	}
+
+#ifdef ENCRYPT_STREAM
+	//never fall back to plain UDP, without the key there is no stream
+	if (!audio_manager.SetPresharedKey(L"C:\\Communicator\\stream.key"))
+	{
+		return 1;
+	}
+#endif
+
+#ifdef REALTIME_PROFILE
+	//keep the sample loops on time when the board is busy
+	audio_manager.SetRealtimeProfile(true);
+#endif
+
+#ifdef RECORD_AUDIO
+	//keep a log of everything said in either direction
+	audio_manager.StartRecording(L"C:\\Communicator\\log");
+#endif
+
+#ifdef ENABLE_TRACE
+	//record a timeline of the audio pipeline, open it in Perfetto to see what made a stutter
+	Tracer::start(L"C:\\Communicator\\trace.json");
+	Tracer::nameThread("audio");
+#endif
+
+#if defined(RECORD_AUDIO) || defined(ENABLE_TRACE)
+	s_audio_manager = &audio_manager;
+	SetConsoleCtrlHandler(finishLogs, TRUE);
+#endif
+
+	//Play startup noise, set Ready Light on
+	audio_manager.PlayWavFile(L"C:\\Communicator\\aud\\ready.wav", DAC_CS_PIN);
+	digitalWrite(READY_LED, 1);
+
+#ifdef FULL_DUPLEX
+	//talk and listen at the same time, the button mutes the microphone
+	audio_manager.StreamDuplexAnalog(DAC_CS_PIN, MICROPHONE_INPUT, CONTROL_BUTTON, 1);
+#endif
+
+	while (true)
+	{
+		if (digitalRead(CONTROL_BUTTON) == 1)
+		{
+			//stream out when the button is pressed, in 1 second clips
+			audio_manager.StreamOutAnalog(DAC_CS_PIN, MICROPHONE_INPUT, CONTROL_BUTTON, 1);
+		}
+		else
+		{
+			//stream in 1 second clips
+			audio_manager.StreamInAnalog(DAC_CS_PIN, CONTROL_BUTTON, 1);
+		}
+	}
+
+
+
 }
\ No newline at end of file
@@ -0,0 +1,739 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// PacketCipher.cpp : XChaCha20-Poly1305 sealing of packets with replay protection
+
+#include "stdafx.h"
+#include "PacketCipher.h"
+#include <bcrypt.h>
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define LOAD32_LE(p) ((UINT32)(p)[0] | ((UINT32)(p)[1] << 8) | ((UINT32)(p)[2] << 16) | ((UINT32)(p)[3] << 24))
+
+#define STORE32_LE(p, v) \
+	(p)[0] = (UINT8)(v); \
+	(p)[1] = (UINT8)((v) >> 8); \
+	(p)[2] = (UINT8)((v) >> 16); \
+	(p)[3] = (UINT8)((v) >> 24);
+
+#define QUARTER_ROUND(a, b, c, d) \
+	a += b; d ^= a; d = ROTL32(d, 16); \
+	c += d; b ^= c; b = ROTL32(b, 12); \
+	a += b; d ^= a; d = ROTL32(d, 8); \
+	c += d; b ^= c; b = ROTL32(b, 7);
+
+#define CHACHA_BLOCK_SIZE 64
+#define POLY1305_MASK 0x3ffffff
+
+/*
+	The 20 rounds of ChaCha on a 16 word state
+*/
+static void chachaRounds(UINT32 x[16])
+{
+	for (int i = 0; i < 10; i++)
+	{
+		QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+		QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+		QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+		QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+		QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+		QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+		QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+		QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+	}
+}
+
+/*
+	Fills in the ChaCha state for a key, block counter and 96 bit nonce
+*/
+static void chachaState(UINT32 state[16], const UINT32 key[8], UINT32 counter, const UINT32 nonce[3])
+{
+	state[0] = 0x61707865;
+	state[1] = 0x3320646e;
+	state[2] = 0x79622d32;
+	state[3] = 0x6b206574;
+	for (int i = 0; i < 8; i++)
+	{
+		state[4 + i] = key[i];
+	}
+	state[12] = counter;
+	state[13] = nonce[0];
+	state[14] = nonce[1];
+	state[15] = nonce[2];
+}
+
+/*
+	Xors length bytes of ChaCha20 keystream, starting at block counter, into out
+*/
+static void chachaXor(const UINT32 key[8], UINT32 counter, const UINT32 nonce[3], UINT8 * out, const UINT8 * in, DWORD length)
+{
+	UINT32 state[16];
+	UINT32 x[16];
+	UINT8 block[CHACHA_BLOCK_SIZE];
+
+	chachaState(state, key, counter, nonce);
+
+	while (length > 0)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			x[i] = state[i];
+		}
+		chachaRounds(x);
+
+		if (length >= CHACHA_BLOCK_SIZE)
+		{
+			//whole blocks are xored a word at a time, straight from the state
+			for (int i = 0; i < 16; i++)
+			{
+				UINT32 word = LOAD32_LE(&in[4 * i]) ^ (x[i] + state[i]);
+				STORE32_LE(&out[4 * i], word);
+			}
+			in += CHACHA_BLOCK_SIZE;
+			out += CHACHA_BLOCK_SIZE;
+			length -= CHACHA_BLOCK_SIZE;
+		}
+		else
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				UINT32 word = x[i] + state[i];
+				STORE32_LE(&block[4 * i], word);
+			}
+			for (DWORD n = 0; n < length; n++)
+			{
+				out[n] = in[n] ^ block[n];
+			}
+			length = 0;
+		}
+
+		state[12]++;
+	}
+
+	SecureZeroMemory(block, sizeof(block));
+}
+
+/*
+	HChaCha20, derives a subkey from a key and 16 bytes of input
+*/
+static void hchacha(const UINT32 key[8], const UINT8 input[16], UINT32 subkey[8])
+{
+	UINT32 x[16];
+	UINT32 nonce[3] = { LOAD32_LE(&input[4]), LOAD32_LE(&input[8]), LOAD32_LE(&input[12]) };
+
+	chachaState(x, key, LOAD32_LE(&input[0]), nonce);
+	chachaRounds(x);
+
+	for (int i = 0; i < 4; i++)
+	{
+		subkey[i] = x[i];
+		subkey[4 + i] = x[12 + i];
+	}
+}
+
+/*
+	Poly1305 with 26 bit limbs, so every product fits the 32x32 to 64 bit multiply
+*/
+struct Poly1305{
+	UINT32 r[5];
+	UINT32 h[5];
+	UINT32 pad[4];
+};
+
+static void polyInit(Poly1305 * poly, const UINT8 key[32])
+{
+	poly->r[0] = (LOAD32_LE(&key[0])) & 0x3ffffff;
+	poly->r[1] = (LOAD32_LE(&key[3]) >> 2) & 0x3ffff03;
+	poly->r[2] = (LOAD32_LE(&key[6]) >> 4) & 0x3ffc0ff;
+	poly->r[3] = (LOAD32_LE(&key[9]) >> 6) & 0x3f03fff;
+	poly->r[4] = (LOAD32_LE(&key[12]) >> 8) & 0x00fffff;
+
+	for (int i = 0; i < 5; i++)
+	{
+		poly->h[i] = 0;
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		poly->pad[i] = LOAD32_LE(&key[16 + 4 * i]);
+	}
+}
+
+/*
+	Adds length bytes to the MAC. A partial last block is padded with zeros, which is
+	the padding the AEAD construction calls for.
+*/
+static void polyBlocks(Poly1305 * poly, const UINT8 * data, DWORD length)
+{
+	const UINT32 r0 = poly->r[0], r1 = poly->r[1], r2 = poly->r[2], r3 = poly->r[3], r4 = poly->r[4];
+	const UINT32 s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+	UINT32 h0 = poly->h[0], h1 = poly->h[1], h2 = poly->h[2], h3 = poly->h[3], h4 = poly->h[4];
+	UINT8 last[16];
+
+	while (length > 0)
+	{
+		const UINT8 * m = data;
+		if (length < 16)
+		{
+			memset(last, 0, sizeof(last));
+			memcpy(last, data, length);
+			m = last;
+		}
+
+		h0 += (LOAD32_LE(&m[0])) & POLY1305_MASK;
+		h1 += (LOAD32_LE(&m[3]) >> 2) & POLY1305_MASK;
+		h2 += (LOAD32_LE(&m[6]) >> 4) & POLY1305_MASK;
+		h3 += (LOAD32_LE(&m[9]) >> 6) & POLY1305_MASK;
+		h4 += (LOAD32_LE(&m[12]) >> 8) | (1 << 24);
+
+		UINT64 d0 = (UINT64)h0 * r0 + (UINT64)h1 * s4 + (UINT64)h2 * s3 + (UINT64)h3 * s2 + (UINT64)h4 * s1;
+		UINT64 d1 = (UINT64)h0 * r1 + (UINT64)h1 * r0 + (UINT64)h2 * s4 + (UINT64)h3 * s3 + (UINT64)h4 * s2;
+		UINT64 d2 = (UINT64)h0 * r2 + (UINT64)h1 * r1 + (UINT64)h2 * r0 + (UINT64)h3 * s4 + (UINT64)h4 * s3;
+		UINT64 d3 = (UINT64)h0 * r3 + (UINT64)h1 * r2 + (UINT64)h2 * r1 + (UINT64)h3 * r0 + (UINT64)h4 * s4;
+		UINT64 d4 = (UINT64)h0 * r4 + (UINT64)h1 * r3 + (UINT64)h2 * r2 + (UINT64)h3 * r1 + (UINT64)h4 * r0;
+
+		UINT32 c = (UINT32)(d0 >> 26); h0 = (UINT32)d0 & POLY1305_MASK;
+		d1 += c; c = (UINT32)(d1 >> 26); h1 = (UINT32)d1 & POLY1305_MASK;
+		d2 += c; c = (UINT32)(d2 >> 26); h2 = (UINT32)d2 & POLY1305_MASK;
+		d3 += c; c = (UINT32)(d3 >> 26); h3 = (UINT32)d3 & POLY1305_MASK;
+		d4 += c; c = (UINT32)(d4 >> 26); h4 = (UINT32)d4 & POLY1305_MASK;
+		h0 += c * 5; c = h0 >> 26; h0 &= POLY1305_MASK;
+		h1 += c;
+
+		if (length < 16)
+		{
+			break;
+		}
+		data += 16;
+		length -= 16;
+	}
+
+	poly->h[0] = h0;
+	poly->h[1] = h1;
+	poly->h[2] = h2;
+	poly->h[3] = h3;
+	poly->h[4] = h4;
+}
+
+/*
+	Finishes the MAC and writes the tag
+*/
+static void polyFinish(Poly1305 * poly, UINT8 tag[16])
+{
+	UINT32 h0 = poly->h[0], h1 = poly->h[1], h2 = poly->h[2], h3 = poly->h[3], h4 = poly->h[4];
+	UINT32 c, g0, g1, g2, g3, g4, mask;
+	UINT64 f;
+
+	//fully carry h
+	c = h1 >> 26; h1 &= POLY1305_MASK;
+	h2 += c; c = h2 >> 26; h2 &= POLY1305_MASK;
+	h3 += c; c = h3 >> 26; h3 &= POLY1305_MASK;
+	h4 += c; c = h4 >> 26; h4 &= POLY1305_MASK;
+	h0 += c * 5; c = h0 >> 26; h0 &= POLY1305_MASK;
+	h1 += c;
+
+	//h - p, chosen over h without branching if h >= p
+	g0 = h0 + 5; c = g0 >> 26; g0 &= POLY1305_MASK;
+	g1 = h1 + c; c = g1 >> 26; g1 &= POLY1305_MASK;
+	g2 = h2 + c; c = g2 >> 26; g2 &= POLY1305_MASK;
+	g3 = h3 + c; c = g3 >> 26; g3 &= POLY1305_MASK;
+	g4 = h4 + c - (1 << 26);
+
+	mask = (g4 >> 31) - 1;
+	g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+	mask = ~mask;
+	h0 = (h0 & mask) | g0;
+	h1 = (h1 & mask) | g1;
+	h2 = (h2 & mask) | g2;
+	h3 = (h3 & mask) | g3;
+	h4 = (h4 & mask) | g4;
+
+	//h mod 2^128, plus the pad
+	h0 = h0 | (h1 << 26);
+	h1 = (h1 >> 6) | (h2 << 20);
+	h2 = (h2 >> 12) | (h3 << 14);
+	h3 = (h3 >> 18) | (h4 << 8);
+
+	f = (UINT64)h0 + poly->pad[0]; h0 = (UINT32)f;
+	f = (UINT64)h1 + poly->pad[1] + (f >> 32); h1 = (UINT32)f;
+	f = (UINT64)h2 + poly->pad[2] + (f >> 32); h2 = (UINT32)f;
+	f = (UINT64)h3 + poly->pad[3] + (f >> 32); h3 = (UINT32)f;
+
+	STORE32_LE(&tag[0], h0);
+	STORE32_LE(&tag[4], h1);
+	STORE32_LE(&tag[8], h2);
+	STORE32_LE(&tag[12], h3);
+
+	SecureZeroMemory(poly, sizeof(Poly1305));
+}
+
+/*
+	The ChaCha20-Poly1305 tag of aad and ciphertext, as in RFC 8439
+*/
+static void aeadTag(const UINT32 key[8], const UINT32 nonce[3], const UINT8 * aad, DWORD aad_length,
+	const UINT8 * ciphertext, DWORD length, UINT8 tag[16])
+{
+	UINT8 poly_key[32];
+	UINT8 lengths[16];
+	Poly1305 poly;
+
+	//the one time key is the start of keystream block 0, the message uses blocks 1 onwards
+	memset(poly_key, 0, sizeof(poly_key));
+	chachaXor(key, 0, nonce, poly_key, poly_key, sizeof(poly_key));
+
+	polyInit(&poly, poly_key);
+	polyBlocks(&poly, aad, aad_length);
+	polyBlocks(&poly, ciphertext, length);
+
+	STORE32_LE(&lengths[0], aad_length);
+	STORE32_LE(&lengths[4], 0);
+	STORE32_LE(&lengths[8], length);
+	STORE32_LE(&lengths[12], 0);
+	polyBlocks(&poly, lengths, sizeof(lengths));
+
+	polyFinish(&poly, tag);
+	SecureZeroMemory(poly_key, sizeof(poly_key));
+}
+
+/*
+	Compares two tags in a time that doesn't depend on where they differ
+*/
+static bool tagsEqual(const UINT8 * a, const UINT8 * b)
+{
+	UINT8 difference = 0;
+
+	for (int i = 0; i < CIPHER_TAG_SIZE; i++)
+	{
+		difference |= a[i] ^ b[i];
+	}
+	return difference == 0;
+}
+
+/*
+	Derives the key of a session from the preshared key. The session fills the first
+	half of the XChaCha20 nonce, the second half is zero.
+*/
+static void sessionKey(const UINT32 key[8], const UINT8 session[CIPHER_SESSION_SIZE], UINT32 subkey[8])
+{
+	UINT8 input[16];
+
+	memset(input, 0, sizeof(input));
+	memcpy(input, session, CIPHER_SESSION_SIZE);
+	hchacha(key, input, subkey);
+}
+
+PacketCipher::PacketCipher()
+{
+	m_enabled = false;
+	m_send_counter = 0;
+	m_receive_valid = false;
+	m_receive_highest = 0;
+	m_receive_window = 0;
+	m_candidate_valid = false;
+	m_candidate_highest = 0;
+	m_candidate_window = 0;
+	m_candidate_count = 0;
+	m_retired_count = 0;
+	m_retired_next = 0;
+	m_rejected = 0;
+	memset(m_key, 0, sizeof(m_key));
+	memset(m_send_key, 0, sizeof(m_send_key));
+	memset(m_send_session, 0, sizeof(m_send_session));
+	memset(m_receive_key, 0, sizeof(m_receive_key));
+	memset(m_receive_session, 0, sizeof(m_receive_session));
+	memset(m_candidate_key, 0, sizeof(m_candidate_key));
+	memset(m_candidate_session, 0, sizeof(m_candidate_session));
+}
+
+PacketCipher::~PacketCipher()
+{
+	clearKey();
+}
+
+/*
+	Sets the preshared key, starts a new sending session and forgets the partner's
+
+	Returns 1 for success, 0 if no random session could be made
+*/
+int PacketCipher::setKey(const UINT8 * key)
+{
+	clearKey();
+
+	//a session that repeated an earlier one would repeat its nonces, so it has to be random
+	if (!BCRYPT_SUCCESS(BCryptGenRandom(NULL, m_send_session, CIPHER_SESSION_SIZE, BCRYPT_USE_SYSTEM_PREFERRED_RNG)))
+	{
+		return 0;
+	}
+
+	for (int i = 0; i < 8; i++)
+	{
+		m_key[i] = LOAD32_LE(&key[4 * i]);
+	}
+	sessionKey(m_key, m_send_session, m_send_key);
+	m_enabled = true;
+	return 1;
+}
+
+/*
+	Forgets the key, packets are no longer sealed or opened
+*/
+void PacketCipher::clearKey()
+{
+	SecureZeroMemory(m_key, sizeof(m_key));
+	SecureZeroMemory(m_send_key, sizeof(m_send_key));
+	SecureZeroMemory(m_receive_key, sizeof(m_receive_key));
+	SecureZeroMemory(m_candidate_key, sizeof(m_candidate_key));
+	m_enabled = false;
+	m_send_counter = 0;
+	m_receive_valid = false;
+	m_candidate_valid = false;
+	m_retired_count = 0;
+	m_retired_next = 0;
+}
+
+/*
+	Returns true once a key has been set
+*/
+bool PacketCipher::enabled()
+{
+	return m_enabled;
+}
+
+/*
+	Encrypts and authenticates a packet
+
+	Returns the size of the sealed packet in bytes
+*/
+DWORD PacketCipher::seal(UINT8 * sealed, const UINT8 * packet, DWORD length)
+{
+	SealedPacketHeader * header = (SealedPacketHeader *)sealed;
+	UINT8 * ciphertext = sealed + sizeof(SealedPacketHeader);
+	UINT64 counter = m_send_counter++;
+	UINT32 nonce[3] = { 0, (UINT32)counter, (UINT32)(counter >> 32) };
+
+	header->type = CIPHER_PACKET_SEALED;
+	memset(header->reserved, 0, sizeof(header->reserved));
+	memcpy(header->session, m_send_session, CIPHER_SESSION_SIZE);
+	header->counter_low = (UINT32)counter;
+	header->counter_high = (UINT32)(counter >> 32);
+
+	chachaXor(m_send_key, 1, nonce, ciphertext, packet, length);
+	aeadTag(m_send_key, nonce, sealed, sizeof(SealedPacketHeader), ciphertext, length, ciphertext + length);
+
+	return length + CIPHER_OVERHEAD;
+}
+
+/*
+	Checks a sealed packet and decrypts it. The tag is checked before anything is
+	decrypted. A new session of the partner only replaces the current one once
+	CIPHER_CANDIDATE_PACKETS of its packets have checked out, each newer than the
+	last, and until then the current session keeps opening.
+
+	Returns the number of bytes written to packet, -1 if the packet was rejected or held back
+*/
+int PacketCipher::open(UINT8 * packet, DWORD packet_size, const UINT8 * sealed, DWORD length)
+{
+	const SealedPacketHeader * header = (const SealedPacketHeader *)sealed;
+	const UINT8 * ciphertext = sealed + sizeof(SealedPacketHeader);
+	UINT32 new_key[8];
+	const UINT32 * key = m_receive_key;
+	bool new_session = false;
+	UINT8 tag[CIPHER_TAG_SIZE];
+
+	if (!m_enabled || length < CIPHER_OVERHEAD || header->type != CIPHER_PACKET_SEALED ||
+		length - CIPHER_OVERHEAD > packet_size)
+	{
+		m_rejected++;
+		return -1;
+	}
+
+	DWORD plain_length = length - CIPHER_OVERHEAD;
+	UINT64 counter = ((UINT64)header->counter_high << 32) | header->counter_low;
+	UINT32 nonce[3] = { 0, header->counter_low, header->counter_high };
+
+	if (m_receive_valid && memcmp(header->session, m_receive_session, CIPHER_SESSION_SIZE) == 0)
+	{
+		if (!acceptCounter(counter, m_receive_highest, m_receive_window, false))
+		{
+			m_rejected++;
+			return -1;
+		}
+	}
+	else
+	{
+		//our own packets reflected back, or ones a session sent before the partner moved on from it
+		bool known = memcmp(header->session, m_send_session, CIPHER_SESSION_SIZE) == 0;
+		for (int i = 0; i < m_retired_count && !known; i++)
+		{
+			known = memcmp(header->session, m_retired[i], CIPHER_SESSION_SIZE) == 0 && counter <= m_retired_highest[i];
+		}
+		if (known)
+		{
+			m_rejected++;
+			return -1;
+		}
+
+		if (m_candidate_valid && memcmp(header->session, m_candidate_session, CIPHER_SESSION_SIZE) == 0)
+		{
+			if (!acceptCounter(counter, m_candidate_highest, m_candidate_window, false))
+			{
+				m_rejected++;
+				return -1;
+			}
+			key = m_candidate_key;
+		}
+		else
+		{
+			sessionKey(m_key, header->session, new_key);
+			key = new_key;
+			new_session = true;
+		}
+	}
+
+	aeadTag(key, nonce, sealed, sizeof(SealedPacketHeader), ciphertext, plain_length, tag);
+	if (!tagsEqual(tag, ciphertext + plain_length))
+	{
+		if (new_session)
+		{
+			SecureZeroMemory(new_key, sizeof(new_key));
+		}
+		m_rejected++;
+		return -1;
+	}
+
+	if (key != m_receive_key)
+	{
+		if (new_session)
+		{
+			//a session not seen before, or one the partner came back to, starts proving itself
+			memcpy(m_candidate_key, new_key, sizeof(m_candidate_key));
+			memcpy(m_candidate_session, header->session, CIPHER_SESSION_SIZE);
+			SecureZeroMemory(new_key, sizeof(new_key));
+			m_candidate_valid = true;
+			m_candidate_highest = counter;
+			m_candidate_window = 1;
+			m_candidate_count = 1;
+		}
+		else
+		{
+			if (counter > m_candidate_highest)
+			{
+				m_candidate_count++;
+			}
+			acceptCounter(counter, m_candidate_highest, m_candidate_window, true);
+		}
+
+		if (m_candidate_count < CIPHER_CANDIDATE_PACKETS)
+		{
+			//authentic, but it could be an old recording, the current session stays
+			return -1;
+		}
+
+		//the partner restarted, its old session can't be used again
+		if (m_receive_valid)
+		{
+			retire(m_receive_session, m_receive_highest);
+		}
+
+		memcpy(m_receive_key, m_candidate_key, sizeof(m_receive_key));
+		memcpy(m_receive_session, m_candidate_session, CIPHER_SESSION_SIZE);
+		SecureZeroMemory(m_candidate_key, sizeof(m_candidate_key));
+		m_candidate_valid = false;
+		m_receive_valid = true;
+		m_receive_highest = m_candidate_highest;
+		m_receive_window = m_candidate_window;
+	}
+	else
+	{
+		acceptCounter(counter, m_receive_highest, m_receive_window, true);
+	}
+
+	chachaXor(m_receive_key, 1, nonce, packet, ciphertext, plain_length);
+	return (int)plain_length;
+}
+
+/*
+	Packets rejected by open
+*/
+LONG PacketCipher::rejectedPackets()
+{
+	return m_rejected;
+}
+
+/*
+	Accepts the counter of an authentic packet against a session's highest counter
+	and window, returns false if it was seen before or is too old to tell. Only
+	records it if update is set, so forged packets can't move the window.
+*/
+bool PacketCipher::acceptCounter(UINT64 counter, UINT64 & highest, UINT64 & window, bool update)
+{
+	if (counter > highest)
+	{
+		if (update)
+		{
+			UINT64 shift = counter - highest;
+			window = (shift >= CIPHER_REPLAY_WINDOW) ? 1 : (window << shift) | 1;
+			highest = counter;
+		}
+		return true;
+	}
+
+	UINT64 age = highest - counter;
+	if (age >= CIPHER_REPLAY_WINDOW || (window & ((UINT64)1 << age)) != 0)
+	{
+		return false;
+	}
+
+	if (update)
+	{
+		window |= (UINT64)1 << age;
+	}
+	return true;
+}
+
+/*
+	Remembers a session the partner has left and the highest counter it sent. If
+	it comes back, only packets newer than that can make it a candidate again.
+*/
+void PacketCipher::retire(const UINT8 * session, UINT64 highest)
+{
+	for (int i = 0; i < m_retired_count; i++)
+	{
+		if (memcmp(session, m_retired[i], CIPHER_SESSION_SIZE) == 0)
+		{
+			m_retired_highest[i] = max(m_retired_highest[i], highest);
+			return;
+		}
+	}
+
+	memcpy(m_retired[m_retired_next], session, CIPHER_SESSION_SIZE);
+	m_retired_highest[m_retired_next] = highest;
+	m_retired_next = (m_retired_next + 1) % CIPHER_RETIRED_SESSIONS;
+	m_retired_count = min(m_retired_count + 1, CIPHER_RETIRED_SESSIONS);
+}
+
+/*
+	Checks the cipher against the ChaCha20-Poly1305 test vector in RFC 8439 section
+	2.8.2, and HChaCha20 against the one in the XChaCha20 draft
+
+	Returns 1 if both match, 0 if not
+*/
+int PacketCipher::selfTest()
+{
+	static const char plaintext[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip "
+		"for the future, sunscreen would be it.";
+	static const UINT8 iv[12] = { 0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47 };
+	static const UINT8 aad[12] = { 0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7 };
+	static const UINT8 expected_start[16] = { 0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb,
+		0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2 };
+	static const UINT8 expected_tag[16] = { 0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a,
+		0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91 };
+	static const UINT8 hchacha_input[16] = { 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x4a,
+		0x00, 0x00, 0x00, 0x00, 0x31, 0x41, 0x59, 0x27 };
+	static const UINT32 hchacha_expected[8] = { 0x423b4182, 0xfe7bb227, 0x50420ed3, 0x737d878a,
+		0xd5e4f9a0, 0x53a8748a, 0x13c42ec1, 0xdcecd326 };
+	const DWORD length = sizeof(plaintext) - 1;
+	UINT8 ciphertext[sizeof(plaintext)];
+	UINT8 decrypted[sizeof(plaintext)];
+	UINT8 tag[CIPHER_TAG_SIZE];
+	UINT32 key[8];
+	UINT32 subkey[8];
+	UINT32 nonce[3];
+
+	for (int i = 0; i < 8; i++)
+	{
+		UINT8 word[4] = { (UINT8)(0x80 + 4 * i), (UINT8)(0x81 + 4 * i), (UINT8)(0x82 + 4 * i), (UINT8)(0x83 + 4 * i) };
+		key[i] = LOAD32_LE(word);
+	}
+	nonce[0] = LOAD32_LE(iv);
+	nonce[1] = LOAD32_LE(&iv[4]);
+	nonce[2] = LOAD32_LE(&iv[8]);
+
+	chachaXor(key, 1, nonce, ciphertext, (const UINT8 *)plaintext, length);
+	aeadTag(key, nonce, aad, sizeof(aad), ciphertext, length, tag);
+	chachaXor(key, 1, nonce, decrypted, ciphertext, length);
+
+	if (memcmp(ciphertext, expected_start, sizeof(expected_start)) != 0 || !tagsEqual(tag, expected_tag) ||
+		memcmp(decrypted, plaintext, length) != 0)
+	{
+		return 0;
+	}
+
+	for (int i = 0; i < 8; i++)
+	{
+		UINT8 word[4] = { (UINT8)(4 * i), (UINT8)(4 * i + 1), (UINT8)(4 * i + 2), (UINT8)(4 * i + 3) };
+		key[i] = LOAD32_LE(word);
+	}
+	hchacha(key, hchacha_input, subkey);
+
+	return memcmp(subkey, hchacha_expected, sizeof(subkey)) == 0 ? 1 : 0;
+}
+
+/*
+	Has a receiver that was restarted take up its partner's live session, then
+	replays a packet the partner sent before the restart in the middle of the
+	stream, several times over. The replay must be held back and the live session
+	must keep opening.
+
+	Returns 1 if the live session still opens, 0 if not
+*/
+int PacketCipher::sessionTest()
+{
+	PacketCipher earlier;
+	PacketCipher sender;
+	PacketCipher receiver;
+	UINT8 key[CIPHER_KEY_SIZE];
+	UINT8 packet[32];
+	UINT8 opened[32];
+	UINT8 old_sealed[sizeof(packet) + CIPHER_OVERHEAD];
+	UINT8 sealed[sizeof(packet) + CIPHER_OVERHEAD];
+
+	for (int i = 0; i < CIPHER_KEY_SIZE; i++)
+	{
+		key[i] = (UINT8)(0xa5 ^ i);
+	}
+	for (int i = 0; i < (int)sizeof(packet); i++)
+	{
+		packet[i] = (UINT8)i;
+	}
+
+	//a packet of the partner's session from before both restarted
+	if (!earlier.setKey(key) || !sender.setKey(key) || !receiver.setKey(key))
+	{
+		return 0;
+	}
+	DWORD old_length = earlier.seal(old_sealed, packet, sizeof(packet));
+
+	for (int i = 0; i < CIPHER_CANDIDATE_PACKETS + 8; i++)
+	{
+		if (i == CIPHER_CANDIDATE_PACKETS + 2)
+		{
+			for (int r = 0; r < CIPHER_CANDIDATE_PACKETS; r++)
+			{
+				if (receiver.open(opened, sizeof(opened), old_sealed, old_length) != -1)
+				{
+					return 0;
+				}
+			}
+		}
+
+		DWORD length = sender.seal(sealed, packet, sizeof(packet));
+		int opened_length = receiver.open(opened, sizeof(opened), sealed, length);
+
+		//the first packets of the session are held back while it proves itself, the rest open
+		if (i < CIPHER_CANDIDATE_PACKETS - 1)
+		{
+			if (opened_length != -1)
+			{
+				return 0;
+			}
+		}
+		else if (opened_length != (int)sizeof(packet) || memcmp(opened, packet, sizeof(packet)) != 0)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
@@ -0,0 +1,165 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* PacketCipher encrypts and authenticates each UDP packet with XChaCha20-Poly1305 under
+* a preshared key, and rejects replayed packets. ChaCha20 only needs 32 bit adds,
+* rotates and xors, so it stays fast on the Quark, which has no SSE or AES instructions.
+**/
+
+#ifndef PACKETCIPHER_H
+#define PACKETCIPHER_H
+
+#include "windows.h"
+
+#define CIPHER_KEY_SIZE 32
+#define CIPHER_TAG_SIZE 16
+#define CIPHER_SESSION_SIZE 8
+
+//marks a sealed packet, alongside STREAM_PACKET_AUDIO and STREAM_PACKET_REPORT
+#define CIPHER_PACKET_SEALED 0xC3
+
+//how far behind the newest packet a late one can arrive and still be accepted
+#define CIPHER_REPLAY_WINDOW 64
+
+//earlier sessions of the partner that are remembered and rejected, so their packets can't be replayed
+#define CIPHER_RETIRED_SESSIONS 8
+
+//packets, each newer than the last, a new session of the partner has to send before it
+//replaces the current one, so one replayed packet of an old session can't take over
+#define CIPHER_CANDIDATE_PACKETS 4
+
+#pragma pack(push, 1)
+
+/*
+	Header of a sealed packet, sent in the clear but authenticated. It is followed by
+	the encrypted packet and the Poly1305 tag. The nonce is the session, eight zero
+	bytes and the counter.
+*/
+struct SealedPacketHeader{
+	UINT8 type; //CIPHER_PACKET_SEALED
+	UINT8 reserved[3];
+	UINT8 session[CIPHER_SESSION_SIZE]; //random for each key set, so a restart never reuses a nonce
+	UINT32 counter_low; //packet counter, increments by one per packet sent
+	UINT32 counter_high;
+};
+
+#pragma pack(pop)
+
+//bytes a sealed packet adds to the packet it carries
+#define CIPHER_OVERHEAD (sizeof(SealedPacketHeader) + CIPHER_TAG_SIZE)
+
+class PacketCipher{
+public:
+	PacketCipher();
+	~PacketCipher();
+
+	/*
+		Sets the preshared key, starts a new sending session and forgets the partner's
+
+		@params:
+		key - CIPHER_KEY_SIZE bytes shared by both communicators
+
+		Returns 1 for success, 0 if no random session could be made
+	*/
+	int setKey(const UINT8 * key);
+
+	/*
+		Forgets the key, packets are no longer sealed or opened
+	*/
+	void clearKey();
+
+	/*
+		Returns true once a key has been set
+	*/
+	bool enabled();
+
+	/*
+		Encrypts and authenticates a packet
+
+		@params:
+		sealed - storage for the sealed packet, at least length + CIPHER_OVERHEAD bytes
+		packet - the packet to send
+		length - the number of bytes in packet
+
+		Returns the size of the sealed packet in bytes
+	*/
+	DWORD seal(UINT8 * sealed, const UINT8 * packet, DWORD length);
+
+	/*
+		Checks a sealed packet and decrypts it. Forged, corrupted and replayed packets
+		are rejected without touching packet. Packets of a new session of the partner
+		are held back the same way until CIPHER_CANDIDATE_PACKETS of them have arrived.
+
+		@params:
+		packet - storage for the decrypted packet
+		packet_size - the size of packet in bytes
+		sealed - the sealed packet received
+		length - the number of bytes received
+
+		Returns the number of bytes written to packet, -1 if the packet was rejected or held back
+	*/
+	int open(UINT8 * packet, DWORD packet_size, const UINT8 * sealed, DWORD length);
+
+	/*
+		Packets rejected by open
+	*/
+	LONG rejectedPackets();
+
+	/*
+		Checks the cipher against the ChaCha20-Poly1305 test vector in RFC 8439
+
+		Returns 1 if it matches, 0 if not
+	*/
+	static int selfTest();
+
+	/*
+		Checks that a replayed packet of an earlier session can't take the place of
+		the partner's live session
+
+		Returns 1 if the live session still opens, 0 if not
+	*/
+	static int sessionTest();
+
+private:
+	/*
+		Accepts the counter of an authentic packet against a session's highest counter
+		and window, returns false if it was seen before or is too old to tell
+	*/
+	static bool acceptCounter(UINT64 counter, UINT64 & highest, UINT64 & window, bool update);
+
+	/*
+		Remembers a session the partner has left and the highest counter it sent
+	*/
+	void retire(const UINT8 * session, UINT64 highest);
+
+	UINT32 m_key[8]; //the preshared key
+	bool m_enabled;
+
+	UINT32 m_send_key[8]; //key of the sending session
+	UINT8 m_send_session[CIPHER_SESSION_SIZE];
+	UINT64 m_send_counter;
+
+	UINT32 m_receive_key[8]; //key of the partner's current session
+	UINT8 m_receive_session[CIPHER_SESSION_SIZE];
+	bool m_receive_valid; //a packet of the partner's session has been accepted
+	UINT64 m_receive_highest; //highest counter accepted
+	UINT64 m_receive_window; //bit n set if m_receive_highest - n was accepted
+
+	UINT32 m_candidate_key[8]; //key of a new session of the partner, not yet trusted
+	UINT8 m_candidate_session[CIPHER_SESSION_SIZE];
+	bool m_candidate_valid;
+	UINT64 m_candidate_highest;
+	UINT64 m_candidate_window;
+	int m_candidate_count; //packets of the candidate accepted, each newer than the last
+
+	UINT8 m_retired[CIPHER_RETIRED_SESSIONS][CIPHER_SESSION_SIZE];
+	UINT64 m_retired_highest[CIPHER_RETIRED_SESSIONS]; //packets at or below are replays
+	int m_retired_count;
+	int m_retired_next;
+
+	volatile LONG m_rejected;
+};
+
+#endif
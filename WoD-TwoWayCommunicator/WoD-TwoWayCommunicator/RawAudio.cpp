@@ -1,400 +1,936 @@
-// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
-// Licensed under the BSD 2 - Clause License.
-// See License.txt in the project root for license information.
-
-#include "RawAudio.h"
-#include "arduino.h"
-#include "MCP4921.h"
-#include "spi.h"
-
-//return 1 if read failed
-#define CHECK_SUCC 	\
-if (succ == 0)\
-{\
-	return 0;\
-}
-
-#define WAV_HEADER_SIZE 46
-
-//tweak these numbers if you're finding the playback is too slow or fast
-#define DELAY_8KHZ 80
-#define DELAY_16KHZ 45
-#define SAMPLE_COUNT_16KHZ 16000
-
-//empty constructor
-RawAudio::RawAudio()
-{
-
-}
-//empty destructor
-RawAudio::~RawAudio()
-{
-
-}
-
-/*
-	Sets up the communicator and destination information for the audio stream
-
-	@params:
-	serv_hostname - the hostname of the server to use for this instance
-	(should be the name of the local pc)
-	dest_hostname - the hostname of the machine to receive streamed data
-
-*/
-int RawAudio::SetupStream(const char * serv_hostname, const char * dest_hostname)
-{
-	m_network_communicator = Communicator();
-	m_network_communicator.startWindowsConnection();
-	m_network_communicator.openUDPSocket();
-	m_network_communicator.setupServerAndBind(serv_hostname);
-	m_network_communicator.setupDestination(dest_hostname);
-	return 0;
-}
-
-/*
-	Tear down networking data structs
-*/
-int RawAudio::TeardownStream()
-{
-	m_network_communicator.closeWindowsConnection();
-	return 0;
-}
-
-/*
-	Prepares the 8 bit samples for the DAC being used
-
-	@params:
-	samples - pointer to the 8 bit audio samples
-	modified - pointer to the modified array for 12bit data samples
-	data - pointer to the storage array to put the converted 8bit bytes
-	control - the DAC control bits
-	file_size - the number of samples
-*/
-int RawAudio::prepareSamplesForDac(UINT8 * samples, UINT16 * modified, UINT8 * data, UINT8 control, DWORD file_size)
-{
-	/*
-	Note: for memory/processing efficiency, this could be folded into one loop
-	It's left as two to illustrate what's going on with the manipulations
-	*/
-	for (DWORD n = 0; n < file_size; n++){
-		//adjust to 12bit unsigned int for MCP4921
-		modified[n] = (UINT16)(((samples[n]) / 255.0) * 4095);
-	}
-
-	//add control bits for MCP4921
-	prependControlBits(data, modified, control, file_size);
-	
-	return 0;
-}
-
-/*
-	Prepends the DAC control bits to the samples modified to the appropriate width for the DAC
-
-	@params:
-	modified - pointer to the modified array for 12bit data samples
-	data - pointer to the storage array to put the converted 8bit bytes
-	control - the DAC control bits
-	file_size - the number of samples
-*/
-int RawAudio::prependControlBits(UINT8 * data, UINT16 * modified, UINT8 control, DWORD file_size)
-{
-	for (DWORD n = 0, x = 0; x < file_size; x++){
-		data[n] = (((control << 4) & 0xF0) | ((modified[x] >> 8) & 0x0F));
-		data[n + 1] = modified[x] & 0xFF;
-		n += 2;
-	}
-
-	return 0;
-}
-
-/*
-	Plays 8-bit PCM 8kHz WAV files.
-
-	@params:
-	file_name - the WAV file to play
-	dac_cs - the GPIO output connected to the dac cs pin
-*/
-int RawAudio::PlayWavFile(LPCWSTR file_name, int dac_cs)
-{
-	HANDLE wav_file;
-	char * buf;
-	int succ;
-	DWORD file_size; //size of file in bytes
-	UINT8 * samples; //holds the 8 bit samples read from the file
-	UINT16 * modified; //holds the 8 bit samples converted into 12 bit samples
-	UINT8 * data; //holds the 8 bit words configured to send to the DAC
-	UINT8 control = CONFIG_DACA | CONFIG_STANDARD_OUTPUT | CONFIG_1X_GAIN | CONFIG_OUTPUT_ON; //DAC control bits
-	DWORD i = 0; //iterator for playback
-
-	wav_file = CreateFile(
-		file_name,
-		GENERIC_READ,
-		FILE_SHARE_READ,
-		NULL,
-		OPEN_EXISTING,
-		FILE_ATTRIBUTE_NORMAL,
-		NULL
-		);
-
-	buf = (char *)malloc(WAV_HEADER_SIZE);
-
-	//read the header bytes in the WAV file
-	succ = ReadFile(
-		wav_file,
-		buf,
-		WAV_HEADER_SIZE,
-		NULL,
-		NULL
-		);
-
-	CHECK_SUCC
-
-	//throw the bytes out -- we are assuming 8kHz 8 bit PCM
-	free(buf);
-
-	//read file into memory
-	file_size = GetFileSize(wav_file, nullptr);
-	file_size = file_size - WAV_HEADER_SIZE; //adjust for header bytes
-	samples = (UINT8 *)malloc(file_size);
-	succ = ReadFile(wav_file, samples, file_size, NULL, NULL);
-
-	CHECK_SUCC
-
-	//pre-prepare the data to send to the DAC
-	data = (UINT8 *)malloc(sizeof(UINT8)* file_size * 2);
-	modified = (UINT16 *)malloc(sizeof(UINT16)* file_size);
-	prepareSamplesForDac(samples, modified, data, control, file_size);
-	
-	file_size = file_size * 2; //compensate for control bytes, samples are now 16bits/sample
-	
-	//prepare pins for SPI
-	pinMode(dac_cs, OUTPUT);
-	digitalWrite(dac_cs, HIGH);
-	SPI.begin();
-	while (i < file_size)
-	{
-		//output a sample
-		digitalWrite(dac_cs, LOW);
-		SPI.transfer(data[i++]);
-		SPI.transfer(data[i++]);
-		digitalWrite(dac_cs, HIGH);
-		//delay to get ~8kHz
-		delayMicroseconds(DELAY_8KHZ);
-	}
-	SPI.end();
-
-	free(samples);
-
-	return 0;
-
-
-}
-
-/*
-	Streams out an 8-bit PCM 8kHz WAV file. Sends the data in chunks of size defined
-	by buf_size
-
-	@params:
-	file_name - the WAV file to be streamed
-	buf_size - the number of samples to be sent,
-	actually ends up sending twice as many bytes as samples
-*/
-int RawAudio::StreamOutWavFile(LPCWSTR file_name, unsigned int buf_size)
-{
-	
-	HANDLE wav_file;
-	char * buf;
-	int succ;
-	DWORD file_size; //size of file in bytes
-	UINT8 * samples; //holds the 8 bit samples read from the file
-	UINT16 * modified; //holds the 8 bit samples converted into 12 bit samples
-	UINT8 * data; //holds the 8 bit words configured to send to the DAC
-	UINT8 control = CONFIG_DACA | CONFIG_STANDARD_OUTPUT | CONFIG_1X_GAIN | CONFIG_OUTPUT_ON; //DAC control
-	int i = 0; //iterator for playback
-
-	wav_file = CreateFile(
-		file_name,
-		GENERIC_READ,
-		FILE_SHARE_READ,
-		NULL,
-		OPEN_EXISTING,
-		FILE_ATTRIBUTE_NORMAL,
-		NULL
-		);
-
-	buf = (char *)malloc(WAV_HEADER_SIZE);
-
-	//read the header bytes
-	succ = ReadFile(
-		wav_file,
-		buf,
-		WAV_HEADER_SIZE,
-		NULL,
-		NULL
-		);
-
-	CHECK_SUCC
-
-	free(buf);
-
-	//read file into memory
-	file_size = GetFileSize(wav_file, nullptr);
-	file_size = file_size - WAV_HEADER_SIZE; //adjust for header bytes
-	samples = (UINT8 *)malloc(file_size);
-	succ = ReadFile(wav_file, samples, file_size, NULL, NULL);
-
-	CHECK_SUCC
-
-	//pre-prepare the data to send to the DAC
-	data = (UINT8 *)malloc(sizeof(UINT8)* file_size * 2);
-	modified = (UINT16 *)malloc(sizeof(UINT16)* file_size);
-	prepareSamplesForDac(samples, modified, data, control, file_size);
-
-	file_size = file_size * 2; //compensate for control bytes, samples are now 16bit/sample
-	for (DWORD n = 0; n < file_size;){
-		m_network_communicator.sendUDPChunk((char *)&data[n], min(buf_size, file_size - buf_size));
-		n += buf_size;
-	}
-
-	free(samples);
-
-	return 0;
-}
-
-/*
-	Stream in 8-bit PCM 8kHz WAV data. Requires the DAC_CS pin to use, and the expected
-	buffer size
-
-	@params:
-	dac_cs - the dac chip select, used to play alerts
-	buf_size - the number of samples to be sent,
-	actually ends up receiving twice as many bytes as samples
-*/
-int RawAudio::StreamAndPlayAudio(int dac_cs, unsigned int buf_size)
-{
-	UINT8 * data = (UINT8 *)malloc(buf_size * 2);
-	pinMode(dac_cs, OUTPUT);
-	digitalWrite(dac_cs, HIGH);
-	SPI.begin();
-
-	//Currently, this function doesn't return.
-	while (true)
-	{
-		int x = m_network_communicator.receiveUDPChunk((char *)data, buf_size);
-
-		//if no data received, do nothing
-		if (x == WSAEWOULDBLOCK)
-		{
-			continue;
-		}
-
-		for (int i = 0; i < x;)
-		{
-			//output a sample
-			digitalWrite(dac_cs, LOW);
-			SPI.transfer(data[i++]);
-			SPI.transfer(data[i++]);
-			digitalWrite(dac_cs, HIGH);
-
-			//delay to get 8kHz
-			delayMicroseconds(DELAY_8KHZ);
-		}
-
-	}
-	SPI.end();
-	return 0;
-}
-
-/*
-	Streams out raw analog samples taken from the analog microphone feeding it's input
-	to input_pin. Records audio at a 16kHz rate, streams until the button defined by
-	control_pin is released
-
-	@params:
-	dac_cs - the dac chip select, used to play alerts
-	input_pin - the pin being fed analog audio data
-	control_pin - the button that needs to be held to stay in record mode
-	buffer_length_in_seconds - defines the size of the buffer to use, in seconds.
-	One second of recorded audio has 16k samples
-*/
-int RawAudio::StreamOutAnalog(int dac_cs, int input_pin, int control_pin, int buffer_length_in_seconds)
-{
-
-	analogReadResolution(12);
-	int buf_size = SAMPLE_COUNT_16KHZ * buffer_length_in_seconds;
-	UINT16 * samples = (UINT16 *)malloc(sizeof(UINT16)* buf_size);
-	UINT8 * data = (UINT8 *)malloc(sizeof(UINT8)* buf_size * 2);
-	UINT8 control = CONFIG_DACA | CONFIG_STANDARD_OUTPUT | CONFIG_1X_GAIN | CONFIG_OUTPUT_ON; //DAC control
-
-	PlayWavFile(L"C:\\Communicator\\aud\\record.wav", dac_cs);
-
-	//while the control pin is pressed, record audio clips
-	//perform checks at 1s intervals so that we don't get stuttering
-	while (digitalRead(control_pin) == 1)
-	{
-		//record samples at a 16kHz rate
-		for (int i = 0; i < buf_size; i++)
-		{
-			samples[i] = analogRead(input_pin);
-			delayMicroseconds(DELAY_16KHZ);
-		}
-
-		//add control bits for MCP4921
-		prependControlBits(data, samples, control, buf_size);
-
-		//transmit
-		m_network_communicator.sendUDPChunk((char *)data, buf_size*2);
-	}
-
-	return 0;
-}
-
-/*
-	Streams in raw analog samples taken from another machine
-	Plays audio at a 16kHz rate, streams until the button defined by control_pin is pressed
-
-	@params:
-	dac_cs - the dac chip select, used to play alerts
-	control_pin - the button that needs to be held to stay in record mode
-	buffer_length_in_seconds - defines the size of the buffer to use, in seconds.
-	One second of recorded audio has 16k samples
-*/
-int RawAudio::StreamInAnalog(int dac_cs, int control_pin, int buffer_length_in_seconds)
-{
-	int buf_size = SAMPLE_COUNT_16KHZ * 2 * buffer_length_in_seconds;
-	UINT8 * data = (UINT8 *)malloc(buf_size);
-
-	PlayWavFile(L"C:\\Communicator\\aud\\waiting.wav", dac_cs);
-
-	pinMode(dac_cs, OUTPUT);
-	digitalWrite(dac_cs, HIGH);
-	SPI.begin();
-
-	//exit when the user presses the transmit button
-	while (digitalRead(control_pin) == 0)
-	{
-		int x = m_network_communicator.receiveUDPChunk((char *)data, buf_size);
-		
-		//if no data received, do nothing
-		if (x == WSAEWOULDBLOCK)
-		{
-			continue;
-		}
-
-		for (int i = 0; i < x;)
-		{
-			//output a sample
-			digitalWrite(dac_cs, LOW);
-			SPI.transfer(data[i++]);
-			SPI.transfer(data[i++]);
-			digitalWrite(dac_cs, HIGH);
-
-			//delay to get 16kHz
-			delayMicroseconds(DELAY_16KHZ);
-		}
-
-	}
-	SPI.end();
-
-	return 0;
-}
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+#include "RawAudio.h"
+#include "arduino.h"
+#include "DacModel.h"
+#include "spi.h"
+#include "Tracer.h"
+
+//return 1 if read failed
+#define CHECK_SUCC 	\
+if (succ == 0)\
+{\
+	return 0;\
+}
+
+//bytes of PCM read from a WAV file per conversion pass
+#define WAV_READ_BLOCK_SIZE 4096
+
+//tweak these numbers if you're finding the playback is too slow or fast
+#define DELAY_8KHZ 80
+#define DELAY_16KHZ 45
+#define SAMPLE_COUNT_16KHZ 16000
+//time taken to shift one word out to the DAC, what DELAY_16KHZ leaves of the 62.5us sample period
+#define SPI_WORD_MICROSECONDS (1000000 / SAMPLE_COUNT_16KHZ - DELAY_16KHZ)
+
+//samples per frame in full duplex mode, 20ms at 16kHz. Must be a multiple of ECHO_BLOCK
+#define DUPLEX_FRAME_SAMPLES 320
+
+//most packets read from the socket between two frames
+#define LINK_MAX_PACKETS 16
+
+//starts the audio frame sequence
+RawAudio::RawAudio()
+{
+	m_sequence = 0;
+}
+//empty destructor
+RawAudio::~RawAudio()
+{
+
+}
+
+/*
+	Sets up the communicator and destination information for the audio stream
+
+	@params:
+	serv_hostname - the hostname of the server to use for this instance
+	(should be the name of the local pc)
+	dest_hostname - the hostname of the machine to receive streamed data
+
+*/
+int RawAudio::SetupStream(const char * serv_hostname, const char * dest_hostname)
+{
+	//reset in place, the communicator owns its socket and key and can't be copied
+	m_network_communicator.reset();
+	m_network_communicator.startWindowsConnection();
+	m_network_communicator.openUDPSocket();
+	m_network_communicator.setupServerAndBind(serv_hostname);
+	m_network_communicator.setupDestination(dest_hostname);
+	return 0;
+}
+
+/*
+	Tear down networking data structs
+*/
+int RawAudio::TeardownStream()
+{
+	m_network_communicator.closeWindowsConnection();
+	return 0;
+}
+
+/*
+	Encrypts and authenticates the stream in both directions with the preshared key
+	held in key_file
+
+	Returns 1 for success, 0 if the key couldn't be read
+*/
+int RawAudio::SetPresharedKey(LPCWSTR key_file)
+{
+	UINT8 key[CIPHER_KEY_SIZE];
+	DWORD bytes_read = 0;
+
+	HANDLE file = CreateFile(key_file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return 0;
+	}
+	BOOL succ = ReadFile(file, key, CIPHER_KEY_SIZE, &bytes_read, NULL);
+	CloseHandle(file);
+
+	int result = 0;
+	if (succ && bytes_read == CIPHER_KEY_SIZE)
+	{
+		result = m_network_communicator.setPresharedKey(key);
+	}
+
+	SecureZeroMemory(key, sizeof(key));
+	return result;
+}
+
+/*
+	Opts the sample loops in or out of the real-time profile: time critical priority,
+	pinned to one CPU, with their buffers prefaulted and locked in memory
+
+	@params:
+	enabled - true to use the profile
+
+	Returns 1 for success, 0 if the profile couldn't be applied
+*/
+int RawAudio::SetRealtimeProfile(bool enabled)
+{
+	return m_realtime.setEnabled(enabled);
+}
+
+/*
+	Starts logging the audio streamed in and out to rotating WAV segments, rx_<n>.wav
+	for received audio and tx_<n>.wav for transmitted audio. Disk writes happen on a
+	background thread, if the disk falls behind frames go unlogged rather than late.
+
+	@params:
+	directory - the directory to write the segments to
+
+	Returns 1 for success, 0 for failure
+*/
+int RawAudio::StartRecording(LPCWSTR directory)
+{
+	WCHAR prefix[MAX_PATH];
+
+	swprintf_s(prefix, MAX_PATH, L"%s\\rx", directory);
+	if (!m_rx_recorder.start(prefix, RECORDER_FORMAT_DAC_WORDS, &m_rx_broadcast))
+	{
+		return 0;
+	}
+
+	swprintf_s(prefix, MAX_PATH, L"%s\\tx", directory);
+	if (!m_tx_recorder.start(prefix, RECORDER_FORMAT_SAMPLES))
+	{
+		m_rx_recorder.stop();
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+	Writes out the audio logged so far and stops recording
+*/
+int RawAudio::StopRecording()
+{
+	m_rx_recorder.stop();
+	m_tx_recorder.stop();
+	return 0;
+}
+
+/*
+	Returns the ring the received audio is decoded into, for readers on other threads
+*/
+BroadcastRing * RawAudio::ReceivedAudio()
+{
+	return &m_rx_broadcast;
+}
+
+/*
+	Handles one received packet. Reports are passed to the rate controller, audio frames
+	are checked by the link monitor and unpacked into 16kHz DAC words
+
+	@params:
+	packet - the received packet
+	length - the number of bytes received
+	words - storage for the DAC words, NULL to only handle reports
+	words_size - the size of words in bytes
+
+	Returns the number of bytes written to words
+*/
+int RawAudio::receivePacket(UINT8 * packet, int length, UINT8 * words, int words_size)
+{
+	if (length == sizeof(ReceiverReport) && packet[0] == STREAM_PACKET_REPORT)
+	{
+		m_rate_controller.onReport((ReceiverReport *)packet, m_sequence);
+		return 0;
+	}
+
+	//audio still in flight from the partner when only reports are wanted is dropped
+	if (words == NULL || length < (int)sizeof(AudioFrameHeader) || packet[0] != STREAM_PACKET_AUDIO)
+	{
+		return 0;
+	}
+
+	//drop duplicates and frames that arrive after a later one
+	int lost = m_link_monitor.onFrame((AudioFrameHeader *)packet, streamClock());
+	if (lost < 0)
+	{
+		return 0;
+	}
+
+	//a single lost frame can be concealed with the copy carried by this one
+	return decodeAudioFrame(packet, length, lost == 1, words, words_size);
+}
+
+/*
+	Sends a receiver report back to the partner when one is due
+*/
+void RawAudio::sendReportIfDue()
+{
+	ReceiverReport report;
+	UINT32 now = streamClock();
+
+	if (m_link_monitor.reportDue(now) == 0)
+	{
+		return;
+	}
+
+	//audio still queued in the socket, two bytes per sample at 16kHz
+	int buffer_depth = m_network_communicator.pendingBytes() / (2 * SAMPLE_COUNT_16KHZ / 1000);
+	m_link_monitor.buildReport(&report, (UINT16)min(buffer_depth, 0xFFFF), now);
+
+	m_network_communicator.sendUDPChunk((char *)&report, sizeof(report));
+}
+
+/*
+	Prepares the 8 bit samples for the DAC being used
+
+	@params:
+	samples - pointer to the 8 bit audio samples
+	modified - pointer to the modified array for 12bit data samples
+	data - pointer to the storage array to put the converted 8bit bytes
+	file_size - the number of samples
+*/
+int RawAudio::prepareSamplesForDac(UINT8 * samples, UINT16 * modified, UINT8 * data, DWORD file_size)
+{
+	/*
+	Note: for memory/processing efficiency, this could be folded into one loop
+	It's left as two to illustrate what's going on with the manipulations
+	*/
+	for (DWORD n = 0; n < file_size; n++){
+		//adjust to 12bit unsigned int for the DAC
+		modified[n] = (UINT16)(((samples[n]) / 255.0) * 4095);
+	}
+
+	//add control bits for the DAC
+	prependControlBits(data, modified, file_size);
+	
+	return 0;
+}
+
+/*
+	Prepends the DAC control bits to the samples modified to the appropriate width for the DAC.
+	The control word and data width come from ActiveDac at compile time, samples go to channel A.
+
+	@params:
+	modified - pointer to the modified array for 12bit data samples
+	data - pointer to the storage array to put the converted 8bit bytes
+	file_size - the number of samples
+*/
+int RawAudio::prependControlBits(UINT8 * data, UINT16 * modified, DWORD file_size)
+{
+	packDacChannel<ActiveDac, DAC_CHANNEL_A>(data, modified, file_size);
+
+	return 0;
+}
+
+/*
+	Reads a PCM WAV file of any supported format and converts it to 12 bit DAC samples
+	at the playout rate
+
+	@params:
+	file_name - the WAV file to read
+	out_rate - the playout rate to convert to. If 0, files at 8kHz or lower play at 8kHz
+	and everything else at 16kHz; set to the chosen rate on return
+	modified - set to the array of 12 bit samples, the caller frees it
+	sample_count - set to the number of samples in modified
+
+	Returns 1 for success, 0 for failure
+*/
+int RawAudio::readWavFile(LPCWSTR file_name, UINT32 * out_rate, UINT16 ** modified, DWORD * sample_count)
+{
+	HANDLE wav_file;
+	WavFormat format;
+	WavConverter converter;
+	UINT8 * block; //holds one block of raw PCM bytes read from the file
+	DWORD remaining; //PCM bytes left to read
+	DWORD bytes_read;
+	int succ;
+
+	wav_file = CreateFile(
+		file_name,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL
+		);
+
+	//parse the header instead of assuming 8kHz 8 bit PCM
+	succ = WavConverter::readWavHeader(wav_file, &format);
+	if (succ == 0)
+	{
+		if (wav_file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(wav_file);
+		}
+		return 0;
+	}
+
+	if (*out_rate == 0)
+	{
+		*out_rate = (format.sample_rate <= WAV_RATE_8KHZ) ? WAV_RATE_8KHZ : WAV_RATE_16KHZ;
+	}
+
+	succ = converter.configure(format, *out_rate);
+	if (succ == 0)
+	{
+		CloseHandle(wav_file);
+		return 0;
+	}
+
+	//convert the file a block at a time rather than holding the raw PCM in memory
+	block = (UINT8 *)malloc(WAV_READ_BLOCK_SIZE);
+	*modified = (UINT16 *)malloc(sizeof(UINT16)* converter.maxOutputSamples(format.data_size));
+	*sample_count = 0;
+	remaining = format.data_size;
+	while (remaining > 0)
+	{
+		succ = ReadFile(wav_file, block, min(remaining, WAV_READ_BLOCK_SIZE), &bytes_read, NULL);
+		if (succ == 0 || bytes_read == 0)
+		{
+			break;
+		}
+		*sample_count += converter.convert(block, bytes_read, &(*modified)[*sample_count]);
+		remaining -= bytes_read;
+	}
+
+	free(block);
+	CloseHandle(wav_file);
+
+	return 1;
+}
+
+/*
+	Plays PCM WAV files. 8, 16 and 24 bit mono or stereo files at common rates
+	are converted to 12 bit mono, at 8kHz for narrowband files and 16kHz otherwise.
+
+	@params:
+	file_name - the WAV file to play
+	dac_cs - the GPIO output connected to the dac cs pin
+*/
+int RawAudio::PlayWavFile(LPCWSTR file_name, int dac_cs)
+{
+	//a dual channel DAC holds channel B at silence
+	return PlayWavFiles(file_name, NULL, dac_cs);
+}
+
+/*
+	Plays two PCM WAV files at once. On a dual channel DAC each file gets its own
+	channel, on a single channel DAC the two are mixed. Both files are converted to
+	the playout rate picked for file_a.
+
+	@params:
+	file_a - the WAV file to play on channel A
+	file_b - the WAV file to play on channel B, NULL to play file_a alone
+	dac_cs - the GPIO output connected to the dac cs pin
+*/
+int RawAudio::PlayWavFiles(LPCWSTR file_a, LPCWSTR file_b, int dac_cs)
+{
+	int succ;
+	UINT32 rate = 0; //playout rate, picked from file_a
+	DWORD file_size; //size of the DAC data in bytes
+	DWORD count_a; //number of samples in file_a at the playout rate
+	DWORD count_b = 0; //number of samples in file_b at the playout rate
+	DWORD frames; //number of sample periods to play
+	UINT16 * modified_a; //holds the samples of file_a converted into 12 bit samples
+	UINT16 * modified_b = NULL; //holds the samples of file_b converted into 12 bit samples
+	UINT8 * data; //holds the 8 bit words configured to send to the DAC
+	DWORD i = 0; //iterator for playback
+
+	succ = readWavFile(file_a, &rate, &modified_a, &count_a);
+
+	CHECK_SUCC
+
+	if (file_b != NULL)
+	{
+		succ = readWavFile(file_b, &rate, &modified_b, &count_b);
+		if (succ == 0)
+		{
+			free(modified_a);
+			return 0;
+		}
+	}
+
+	//pre-prepare the data to send to the DAC, one word per channel per sample period
+	data = (UINT8 *)malloc(sizeof(UINT8)* max(count_a, count_b) * 2 * ActiveDac::channels);
+	if (file_b == NULL && ActiveDac::channels == 1)
+	{
+		//nothing to mix, file_a plays at full level
+		prependControlBits(data, modified_a, count_a);
+		frames = count_a;
+	}
+	else
+	{
+		frames = DacPairPacker<ActiveDac>::pack(data, modified_a, count_a, modified_b, count_b);
+	}
+	free(modified_a);
+	free(modified_b);
+
+	file_size = frames * 2 * ActiveDac::channels;
+
+	//the delays are tuned for one word per sample period, take the time of the extra words off
+	int delay = (rate == WAV_RATE_16KHZ) ? DELAY_16KHZ : DELAY_8KHZ;
+	delay -= (ActiveDac::channels - 1) * SPI_WORD_MICROSECONDS;
+
+	//prepare pins for SPI
+	pinMode(dac_cs, OUTPUT);
+	digitalWrite(dac_cs, HIGH);
+	m_realtime.lockBuffer(data, file_size);
+	m_realtime.enterAudioThread();
+	SPI.begin();
+	while (i < file_size)
+	{
+		//output a sample on each channel, the loop is unrolled at compile time
+		for (int c = 0; c < ActiveDac::channels; c++)
+		{
+			digitalWrite(dac_cs, LOW);
+			SPI.transfer(data[i++]);
+			SPI.transfer(data[i++]);
+			digitalWrite(dac_cs, HIGH);
+		}
+		//delay to get ~8kHz or ~16kHz
+		delayMicroseconds(delay);
+	}
+	SPI.end();
+	m_realtime.leaveAudioThread();
+	m_realtime.unlockBuffer(data, file_size);
+
+	free(data);
+
+	return 0;
+}
+
+/*
+	Streams out a PCM WAV file, converted to 12 bit mono at out_rate. Sends the data
+	in chunks of size defined by buf_size
+
+	@params:
+	file_name - the WAV file to be streamed
+	buf_size - the number of samples to be sent,
+	actually ends up sending twice as many bytes as samples
+	out_rate - the rate the receiver plays at, WAV_RATE_8KHZ or WAV_RATE_16KHZ
+*/
+int RawAudio::StreamOutWavFile(LPCWSTR file_name, unsigned int buf_size, UINT32 out_rate)
+{
+	int succ;
+	DWORD file_size; //size of the DAC data in bytes
+	DWORD sample_count; //number of samples at out_rate
+	UINT16 * modified; //holds the samples converted into 12 bit samples
+	UINT8 * data; //holds the 8 bit words configured to send to the DAC
+
+	succ = readWavFile(file_name, &out_rate, &modified, &sample_count);
+
+	CHECK_SUCC
+
+	//pre-prepare the data to send to the DAC
+	data = (UINT8 *)malloc(sizeof(UINT8)* sample_count * 2);
+	prependControlBits(data, modified, sample_count);
+	free(modified);
+
+	file_size = sample_count * 2; //compensate for control bytes, samples are now 16bit/sample
+	for (DWORD n = 0; n < file_size;){
+		m_network_communicator.sendUDPChunk((char *)&data[n], min(buf_size, file_size - n));
+		n += buf_size;
+	}
+
+	free(data);
+
+	return 0;
+}
+
+/*
+	Stream in 8-bit PCM 8kHz WAV data. Requires the DAC_CS pin to use, and the expected
+	buffer size
+
+	@params:
+	dac_cs - the dac chip select, used to play alerts
+	buf_size - the number of samples to be sent,
+	actually ends up receiving twice as many bytes as samples
+*/
+int RawAudio::StreamAndPlayAudio(int dac_cs, unsigned int buf_size)
+{
+	UINT8 * data = (UINT8 *)malloc(buf_size * 2);
+	pinMode(dac_cs, OUTPUT);
+	digitalWrite(dac_cs, HIGH);
+	SPI.begin();
+
+	//Currently, this function doesn't return.
+	while (true)
+	{
+		int x = m_network_communicator.receiveUDPChunk((char *)data, buf_size);
+
+		//if no data received, do nothing
+		if (x == SOCKET_ERROR)
+		{
+			continue;
+		}
+
+		for (int i = 0; i < x;)
+		{
+			//output a sample
+			digitalWrite(dac_cs, LOW);
+			SPI.transfer(data[i++]);
+			SPI.transfer(data[i++]);
+			digitalWrite(dac_cs, HIGH);
+
+			//delay to get 8kHz
+			delayMicroseconds(DELAY_8KHZ);
+		}
+
+	}
+	SPI.end();
+	return 0;
+}
+
+/*
+	Streams out raw analog samples taken from the analog microphone feeding it's input
+	to input_pin. Records audio at a 16kHz rate, streams until the button defined by
+	control_pin is released. Frame size, send rate and redundancy follow the reports
+	sent back by the receiver
+
+	@params:
+	dac_cs - the dac chip select, used to play alerts
+	input_pin - the pin being fed analog audio data
+	control_pin - the button that needs to be held to stay in record mode
+	buffer_length_in_seconds - defines the largest frame to send, in seconds.
+	One second of recorded audio has 16k samples
+*/
+int RawAudio::StreamOutAnalog(int dac_cs, int input_pin, int control_pin, int buffer_length_in_seconds)
+{
+
+	analogReadResolution(12);
+	int buf_size = SAMPLE_COUNT_16KHZ * buffer_length_in_seconds;
+	UINT16 * samples = (UINT16 *)malloc(sizeof(UINT16)* buf_size); //used when the recorder can't take a frame
+	UINT16 * spare = (UINT16 *)malloc(sizeof(UINT16)* buf_size);
+	UINT16 * previous = NULL; //the last frame sent, for redundancy
+	UINT8 * packet = (UINT8 *)malloc(streamPacketSize(buf_size, 1, buf_size));
+	UINT8 * report = (UINT8 *)malloc(MAX_PACKET_SIZE); //audio the partner still has in flight arrives here too
+	DWORD previous_count = 0;
+
+	PlayWavFile(L"C:\\Communicator\\aud\\record.wav", dac_cs);
+
+	m_realtime.lockBuffer(samples, sizeof(UINT16)* buf_size);
+	m_realtime.lockBuffer(spare, sizeof(UINT16)* buf_size);
+	m_realtime.lockBuffer(packet, streamPacketSize(buf_size, 1, buf_size));
+	m_realtime.lockBuffer(report, MAX_PACKET_SIZE);
+	m_realtime.lockBuffer(m_tx_recorder.buffer(), RECORDER_RING_SIZE);
+	m_realtime.lockBuffer(m_network_communicator.sealedBuffer(), MAX_PACKET_SIZE);
+	m_realtime.enterAudioThread();
+
+	//while the control pin is pressed, record audio clips
+	//the clip length comes from the rate controller, the pin is checked between clips
+	while (digitalRead(control_pin) == 1)
+	{
+		int frame = min((int)m_rate_controller.frameSamples(), buf_size);
+		UINT32 timestamp = streamClock();
+
+		//capture straight into the recorder, or into whichever local buffer isn't holding the previous frame
+		UINT16 * capture = (UINT16 *)m_tx_recorder.acquire(sizeof(UINT16)* frame);
+		if (capture == NULL)
+		{
+			capture = (previous == samples) ? spare : samples;
+		}
+
+		//record samples at a 16kHz rate
+		{
+			TRACE_SCOPE_DEADLINE("capture frame", frame);
+			for (int i = 0; i < frame; i++)
+			{
+				capture[i] = analogRead(input_pin);
+				delayMicroseconds(DELAY_16KHZ);
+			}
+		}
+
+		//add the frame header and control bits, at the rate and redundancy the link can take
+		DWORD length = encodeAudioFrame(packet, m_sequence++, timestamp, capture, frame,
+			m_rate_controller.rateDivider(), m_rate_controller.redundancy() ? previous : NULL, previous_count);
+
+		//transmit
+		m_network_communicator.sendUDPChunk((char *)packet, length);
+
+		//log it, the recorder leaves it in place so it can still be the next one's redundant copy
+		m_tx_recorder.commit(capture, sizeof(UINT16)* frame);
+		previous = capture;
+		previous_count = frame;
+
+		//pick up any reports from the receiver
+		for (int r = 0; r < LINK_MAX_PACKETS; r++)
+		{
+			int x = m_network_communicator.receiveUDPChunk((char *)report, MAX_PACKET_SIZE);
+			if (x == SOCKET_ERROR)
+			{
+				break;
+			}
+			receivePacket(report, x, NULL, 0);
+		}
+
+		//give the recorder and tracer a moment on the CPU before the next frame
+		m_realtime.yield();
+	}
+
+	m_realtime.leaveAudioThread();
+	m_realtime.unlockBuffer(samples, sizeof(UINT16)* buf_size);
+	m_realtime.unlockBuffer(spare, sizeof(UINT16)* buf_size);
+	m_realtime.unlockBuffer(packet, streamPacketSize(buf_size, 1, buf_size));
+	m_realtime.unlockBuffer(report, MAX_PACKET_SIZE);
+	m_realtime.unlockBuffer(m_tx_recorder.buffer(), RECORDER_RING_SIZE);
+	m_realtime.unlockBuffer(m_network_communicator.sealedBuffer(), MAX_PACKET_SIZE);
+
+	free(samples);
+	free(spare);
+	free(packet);
+	free(report);
+
+	return 0;
+}
+
+/*
+	Streams in raw analog samples taken from another machine
+	Plays audio at a 16kHz rate, streams until the button defined by control_pin is pressed.
+	Reports loss, jitter and buffer depth back to the sender every LINK_REPORT_INTERVAL
+
+	@params:
+	dac_cs - the dac chip select, used to play alerts
+	control_pin - the button that needs to be held to stay in record mode
+	buffer_length_in_seconds - defines the size of the buffer to use, in seconds.
+	One second of recorded audio has 16k samples
+*/
+int RawAudio::StreamInAnalog(int dac_cs, int control_pin, int buffer_length_in_seconds)
+{
+	int max_samples = SAMPLE_COUNT_16KHZ * buffer_length_in_seconds;
+	int buf_size = streamPacketSize(max_samples, 1, max_samples);
+	int data_size = max_samples * 4; //a frame at 16kHz, plus a concealed copy of the one before
+	UINT8 * packet = (UINT8 *)malloc(buf_size);
+	UINT8 * data = (UINT8 *)malloc(data_size);
+
+	PlayWavFile(L"C:\\Communicator\\aud\\waiting.wav", dac_cs);
+
+	//the sender may have been quiet for a while, start loss and jitter afresh
+	m_link_monitor.reset();
+
+	pinMode(dac_cs, OUTPUT);
+	digitalWrite(dac_cs, HIGH);
+	m_realtime.lockBuffer(packet, buf_size);
+	m_realtime.lockBuffer(data, data_size);
+	m_realtime.lockBuffer(m_rx_broadcast.buffer(), BROADCAST_RING_SIZE);
+	m_realtime.lockBuffer(m_network_communicator.sealedBuffer(), MAX_PACKET_SIZE);
+	m_realtime.enterAudioThread();
+	SPI.begin();
+
+	//exit when the user presses the transmit button
+	while (digitalRead(control_pin) == 0)
+	{
+		int x = m_network_communicator.receiveUDPChunk((char *)packet, buf_size);
+		
+		//if no data received, let the recorder and tracer run while waiting
+		if (x == SOCKET_ERROR)
+		{
+			m_realtime.yield();
+			continue;
+		}
+
+		//unpack the frame into DAC words at 16kHz, straight into the broadcast ring when anything reads it
+		UINT8 * words = m_rx_broadcast.acquire(data_size);
+		if (words == NULL)
+		{
+			words = data;
+		}
+		x = receivePacket(packet, x, words, data_size);
+		m_rx_broadcast.commit(words, x);
+
+		{
+			TRACE_SCOPE_DEADLINE("spi burst", x / 2);
+			for (int i = 0; i < x;)
+			{
+				//output a sample
+				digitalWrite(dac_cs, LOW);
+				SPI.transfer(words[i++]);
+				SPI.transfer(words[i++]);
+				digitalWrite(dac_cs, HIGH);
+
+				//delay to get 16kHz
+				delayMicroseconds(DELAY_16KHZ);
+			}
+		}
+
+		//tell the sender how the stream is arriving
+		sendReportIfDue();
+
+		//give the recorder and tracer a moment on the CPU before the next frame
+		m_realtime.yield();
+	}
+	SPI.end();
+	m_realtime.leaveAudioThread();
+	m_realtime.unlockBuffer(packet, buf_size);
+	m_realtime.unlockBuffer(data, data_size);
+	m_realtime.unlockBuffer(m_rx_broadcast.buffer(), BROADCAST_RING_SIZE);
+	m_realtime.unlockBuffer(m_network_communicator.sealedBuffer(), MAX_PACKET_SIZE);
+
+	free(packet);
+	free(data);
+
+	return 0;
+}
+
+/*
+	Streams raw analog samples in both directions at once, at a 16kHz rate.
+	Received audio is played while the microphone is recorded, and the echo of the
+	speaker is removed from the recording before it is sent. Holding the button
+	defined by control_pin mutes the microphone. Currently, this function doesn't return.
+
+	@params:
+	dac_cs - the dac chip select
+	input_pin - the pin being fed analog audio data
+	control_pin - the button that mutes the microphone while held
+	buffer_length_in_seconds - defines the size of the receive buffer to use, in seconds.
+	One second of recorded audio has 16k samples
+*/
+int RawAudio::StreamDuplexAnalog(int dac_cs, int input_pin, int control_pin, int buffer_length_in_seconds)
+{
+	analogReadResolution(12);
+	int max_samples = SAMPLE_COUNT_16KHZ * buffer_length_in_seconds;
+	int packet_size = streamPacketSize(max_samples, 1, max_samples);
+	int play_size = max_samples * 4; //a frame at 16kHz, plus a concealed copy of the one before
+	int data_size = streamPacketSize(DUPLEX_FRAME_SAMPLES, 1, DUPLEX_FRAME_SAMPLES);
+	UINT8 * packet = (UINT8 *)malloc(packet_size);
+	UINT8 * received = (UINT8 *)malloc(play_size); //used when nothing reads the broadcast ring
+	UINT8 * play_data = received; //received DAC words waiting to be played
+	UINT16 * references = (UINT16 *)malloc(sizeof(UINT16)* DUPLEX_FRAME_SAMPLES * 2); //12 bit samples played, one frame capturing and one being cancelled
+	UINT16 * frames = (UINT16 *)malloc(sizeof(UINT16)* DUPLEX_FRAME_SAMPLES * 3); //capturing, being cancelled, and the last one sent
+	UINT8 * data = (UINT8 *)malloc(data_size);
+	UINT16 * capture = frames; //the frame being captured
+	UINT16 * reference = references; //what was played while capture was recorded
+	UINT16 * pending = NULL; //the last frame captured, cancelled and sent during this one
+	UINT16 * pending_reference = NULL;
+	UINT16 * previous = NULL; //the last frame sent, for redundancy
+	DWORD previous_count = 0;
+	DWORD cancelled = 0; //samples of pending with the echo removed
+	bool pending_muted = false;
+	UINT32 timestamp = 0; //stream clock when capture started
+	UINT32 pending_timestamp = 0;
+	int play_length = 0;
+	int play_pos = 0;
+	int i = 0; //sample period within the frame
+
+	m_echo_canceller.reset();
+	m_link_monitor.reset();
+
+	pinMode(dac_cs, OUTPUT);
+	digitalWrite(dac_cs, HIGH);
+	m_realtime.lockBuffer(packet, packet_size);
+	m_realtime.lockBuffer(received, play_size);
+	m_realtime.lockBuffer(references, sizeof(UINT16)* DUPLEX_FRAME_SAMPLES * 2);
+	m_realtime.lockBuffer(frames, sizeof(UINT16)* DUPLEX_FRAME_SAMPLES * 3);
+	m_realtime.lockBuffer(data, data_size);
+	m_realtime.lockBuffer(m_rx_broadcast.buffer(), BROADCAST_RING_SIZE);
+	m_realtime.lockBuffer(m_tx_recorder.buffer(), RECORDER_RING_SIZE);
+	m_realtime.lockBuffer(m_network_communicator.sealedBuffer(), MAX_PACKET_SIZE);
+	m_realtime.enterAudioThread();
+	SPI.begin();
+
+#ifdef ENABLE_TRACE
+	LONGLONG frame_start = Tracer::now();
+#endif
+
+	/*
+		Playout and capture never stop. The work between frames (echo cancelling, encoding,
+		sending and receiving) is done a piece at a time after the sample of a period, and
+		the periods are paced by the stream clock rather than a fixed delay, so the time a
+		piece takes comes out of the wait for the next sample instead of opening a gap.
+	*/
+	UINT32 next = streamClock();
+	while (true)
+	{
+		//wait for the sample period, starting again from now if it fell more than a frame behind
+		UINT32 now = streamClock();
+		if ((INT32)(now - next) > DUPLEX_FRAME_SAMPLES)
+		{
+			next = now;
+		}
+		while ((INT32)(now - next) < 0)
+		{
+			now = streamClock();
+		}
+		if (i == 0)
+		{
+			timestamp = next;
+		}
+		next++;
+
+		if (play_pos < play_length)
+		{
+			//output a sample, and remember it as the echo reference for this sample period
+			digitalWrite(dac_cs, LOW);
+			SPI.transfer(play_data[play_pos]);
+			SPI.transfer(play_data[play_pos + 1]);
+			digitalWrite(dac_cs, HIGH);
+			reference[i] = (UINT16)(((play_data[play_pos] & 0x0F) << 8) | play_data[play_pos + 1]);
+			play_pos += 2;
+		}
+		else
+		{
+			reference[i] = DAC_SILENCE;
+		}
+
+		capture[i] = analogRead(input_pin);
+		i++;
+
+		//one piece of work per period, refilling the playout buffer gets every other period while a frame is pending
+		bool refill = (play_pos >= play_length) && (pending == NULL || (i & 1) != 0);
+		if (refill)
+		{
+			play_pos = 0;
+			play_length = 0;
+
+			//unpack straight into the broadcast ring when anything reads it, and play from there
+			play_data = m_rx_broadcast.acquire(play_size);
+			if (play_data == NULL)
+			{
+				play_data = received;
+			}
+
+			//reports may be queued in front of the next audio frame
+			for (int r = 0; r < LINK_MAX_PACKETS && play_length == 0; r++)
+			{
+				int x = m_network_communicator.receiveUDPChunk((char *)packet, packet_size);
+				if (x == SOCKET_ERROR)
+				{
+					break;
+				}
+				play_length = receivePacket(packet, x, play_data, play_size);
+			}
+			m_rx_broadcast.commit(play_data, play_length);
+
+			//tell the partner how its stream is arriving
+			sendReportIfDue();
+		}
+		else if (pending != NULL && cancelled < DUPLEX_FRAME_SAMPLES)
+		{
+			//remove the speaker's echo from the last frame, one filter block at a time
+			m_echo_canceller.process(&pending_reference[cancelled], &pending[cancelled], &pending[cancelled], ECHO_BLOCK);
+			cancelled += ECHO_BLOCK;
+		}
+		else if (pending != NULL)
+		{
+			if (!pending_muted)
+			{
+				//add the frame header and control bits, frames stay 20ms to match the echo canceller
+				DWORD length = encodeAudioFrame(data, m_sequence++, pending_timestamp, pending, DUPLEX_FRAME_SAMPLES,
+					m_rate_controller.rateDivider(), m_rate_controller.redundancy() ? previous : NULL, previous_count);
+
+				//transmit
+				m_network_communicator.sendUDPChunk((char *)data, length);
+
+				//log it, the frame is still needed as the next one's redundant copy so the recorder gets its own
+				UINT8 * logged = m_tx_recorder.acquire(sizeof(UINT16)* DUPLEX_FRAME_SAMPLES);
+				if (logged != NULL)
+				{
+					memcpy(logged, pending, sizeof(UINT16)* DUPLEX_FRAME_SAMPLES);
+					m_tx_recorder.commit(logged, sizeof(UINT16)* DUPLEX_FRAME_SAMPLES);
+				}
+				previous = pending;
+				previous_count = DUPLEX_FRAME_SAMPLES;
+			}
+			else
+			{
+				//muted, nothing is sent or logged, and a redundant copy of an old frame would be out of place
+				previous_count = 0;
+			}
+			pending = NULL;
+		}
+
+		if (i < DUPLEX_FRAME_SAMPLES)
+		{
+			continue;
+		}
+
+#ifdef ENABLE_TRACE
+		Tracer::complete("duplex frame", frame_start, Tracer::frameDeadline(DUPLEX_FRAME_SAMPLES));
+		frame_start = Tracer::now();
+#endif
+
+		/*
+			Hand the frame over to be cancelled and sent during the next one. Cancelling
+			and sending take at most 2 * DUPLEX_FRAME_SAMPLES / ECHO_BLOCK + 2 periods,
+			well inside a frame, so the last one has always been sent by now.
+		*/
+		pending = capture;
+		pending_reference = reference;
+		pending_timestamp = timestamp;
+		pending_muted = (digitalRead(control_pin) != 0);
+		cancelled = 0;
+
+		//capture into whichever buffer is neither pending nor the redundant copy
+		for (int f = 0; f < 3; f++)
+		{
+			UINT16 * frame = &frames[f * DUPLEX_FRAME_SAMPLES];
+			if (frame != pending && frame != previous)
+			{
+				capture = frame;
+				break;
+			}
+		}
+		reference = (reference == references) ? &references[DUPLEX_FRAME_SAMPLES] : references;
+		i = 0;
+
+		//give the recorder and tracer a moment on the CPU, the stream clock makes up for it
+		m_realtime.yield();
+	}
+	SPI.end();
+	m_realtime.leaveAudioThread();
+	m_realtime.unlockBuffer(packet, packet_size);
+	m_realtime.unlockBuffer(received, play_size);
+	m_realtime.unlockBuffer(references, sizeof(UINT16)* DUPLEX_FRAME_SAMPLES * 2);
+	m_realtime.unlockBuffer(frames, sizeof(UINT16)* DUPLEX_FRAME_SAMPLES * 3);
+	m_realtime.unlockBuffer(data, data_size);
+	m_realtime.unlockBuffer(m_rx_broadcast.buffer(), BROADCAST_RING_SIZE);
+	m_realtime.unlockBuffer(m_tx_recorder.buffer(), RECORDER_RING_SIZE);
+	m_realtime.unlockBuffer(m_network_communicator.sealedBuffer(), MAX_PACKET_SIZE);
+
+	free(packet);
+	free(received);
+	free(references);
+	free(frames);
+	free(data);
+
+	return 0;
+}
@@ -1,123 +1,248 @@
-// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
-// Licensed under the BSD 2 - Clause License.
-// See License.txt in the project root for license information.
-
-/**
-* Communicator is a wrapper for setup and management of UDP communication
-**/
-
-#ifndef RAWAUDIO_H
-#define RAWAUDIO_H
-
-#include "windows.h"
-#include "Communicator.h"
-
-class RawAudio{
-	Communicator m_network_communicator;
-public:
-
-	RawAudio();
-	~RawAudio();
-
-	/*
-		Sets up the communicator and destination information for the audio stream
-
-		@params:
-		serv_hostname - the hostname of the server to use for this instance
-		(should be the name of the local pc)
-		dest_hostname - the hostname of the machine to receive streamed data
-
-	*/
-	int SetupStream(const char * serv_hostname, const char * dest_hostname);
-
-	/*
-		Tear down networking data structs
-	*/
-	int TeardownStream();
-
-	/*
-		Prepares the 8 bit samples for the DAC being used
-		
-		@params:
-		samples - pointer to the 8 bit audio samples
-		modified - pointer to the modified array for 12bit data samples
-		data - pointer to the storage array to put the converted 8bit bytes
-		control - the DAC control bits
-		file_size - the number of samples
-	*/
-	int prepareSamplesForDac(UINT8 * samples, UINT16 * modified, UINT8 * data, UINT8 control, DWORD file_size);
-
-	/*
-		Prepends the DAC control bits to the samples modified to the appropriate width for the DAC
-
-		@params:
-		modified - pointer to the modified array for 12bit data samples
-		data - pointer to the storage array to put the converted 8bit bytes
-		control - the DAC control bits
-		file_size - the number of samples
-	*/
-	int prependControlBits(UINT8 * data, UINT16 * modified, UINT8 control, DWORD file_size);
-
-	/*
-		Plays 8-bit PCM 8kHz WAV files.
-
-		@params:
-		file_name - the WAV file to play
-		dac_cs - the GPIO output connected to the dac cs pin
-	*/
-	int PlayWavFile(LPCWSTR file_name, int dac_cs);
-
-	/*
-		Streams out an 8-bit PCM 8kHz WAV file. Sends the data in chunks of size defined
-		by buf_size
-
-		@params:
-		file_name - the WAV file to be streamed
-		buf_size - the number of samples to be sent,
-		actually ends up sending twice as many bytes as samples
-	*/
-	int StreamOutWavFile(LPCWSTR file_name, unsigned int buf_size);
-	
-	/*
-		Stream in 8-bit PCM 8kHz WAV data. Requires the DAC_CS pin to use, and the expected 
-		buffer size
-
-		@params:
-		dac_cs - the dac chip select, used to play alerts
-		buf_size - the number of samples to be sent, 
-			actually ends up receiving twice as many bytes as samples
-	*/
-	int StreamAndPlayAudio(int dac_cs, unsigned int buf_size);
-
-	/*
-		Streams out raw analog samples taken from the analog microphone feeding it's input 
-		to input_pin. Records audio at a 16kHz rate, streams until the button defined by 
-		control_pin is released
-
-		@params:
-		dac_cs - the dac chip select, used to play alerts
-		input_pin - the pin being fed analog audio data
-		control_pin - the button that needs to be held to stay in record mode
-		buffer_length_in_seconds - defines the size of the buffer to use, in seconds. 
-			One second of recorded audio has 16k samples
-	*/
-	int StreamOutAnalog(int dac_cs, int input_pin, int control_pin, int buffer_length_in_seconds);
-
-	/*
-		Streams in raw analog samples taken from another machine
-		Plays audio at a 16kHz rate, streams until the button defined by control_pin is pressed
-
-		@params:
-		dac_cs - the dac chip select, used to play alerts
-		control_pin - the button that needs to be held to stay in record mode
-		buffer_length_in_seconds - defines the size of the buffer to use, in seconds.
-			One second of recorded audio has 16k samples
-	*/
-	int StreamInAnalog(int dac_cs, int control_pin, int buffer_length_in_seconds);
-
-
-
-};
-
-
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* Communicator is a wrapper for setup and management of UDP communication
+**/
+
+#ifndef RAWAUDIO_H
+#define RAWAUDIO_H
+
+#include "windows.h"
+#include "Communicator.h"
+#include "WavConverter.h"
+#include "EchoCanceller.h"
+#include "LinkControl.h"
+#include "RealtimeProfile.h"
+#include "AudioRecorder.h"
+#include "BroadcastRing.h"
+
+class RawAudio{
+	Communicator m_network_communicator;
+	EchoCanceller m_echo_canceller;
+	LinkMonitor m_link_monitor;
+	RateController m_rate_controller;
+	UINT32 m_sequence; //sequence number of the next audio frame sent
+	RealtimeProfile m_realtime;
+	BroadcastRing m_rx_broadcast; //received frames as DAC words, played in place and shared with any readers
+	AudioRecorder m_rx_recorder; //log of the audio received
+	AudioRecorder m_tx_recorder; //log of the audio sent
+public:
+
+	RawAudio();
+	~RawAudio();
+
+	/*
+		Sets up the communicator and destination information for the audio stream
+
+		@params:
+		serv_hostname - the hostname of the server to use for this instance
+		(should be the name of the local pc)
+		dest_hostname - the hostname of the machine to receive streamed data
+
+	*/
+	int SetupStream(const char * serv_hostname, const char * dest_hostname);
+
+	/*
+		Tear down networking data structs
+	*/
+	int TeardownStream();
+
+	/*
+		Encrypts and authenticates the stream in both directions with a preshared key,
+		and drops forged or replayed packets. Call after SetupStream.
+
+		@params:
+		key_file - a file holding the CIPHER_KEY_SIZE byte key, the same on both communicators
+
+		Returns 1 for success, 0 if the key couldn't be read
+	*/
+	int SetPresharedKey(LPCWSTR key_file);
+
+	/*
+		Opts the sample loops in or out of the real-time profile: while a loop runs the
+		process is at high priority and the loop at time critical priority, pinned to one
+		CPU, with its buffers prefaulted and locked in memory
+
+		@params:
+		enabled - true to use the profile
+
+		Returns 1 for success, 0 if the profile couldn't be applied
+	*/
+	int SetRealtimeProfile(bool enabled);
+
+	/*
+		Starts logging the audio streamed in and out to rotating WAV segments, rx_<n>.wav
+		for received audio and tx_<n>.wav for transmitted audio. Disk writes happen on a
+		background thread, if the disk falls behind frames go unlogged rather than late.
+
+		@params:
+		directory - the directory to write the segments to
+
+		Returns 1 for success, 0 for failure
+	*/
+	int StartRecording(LPCWSTR directory);
+
+	/*
+		Writes out the audio logged so far and stops recording. It is safe to call
+		from a console control handler while a sample loop is running.
+	*/
+	int StopRecording();
+
+	/*
+		Returns the ring the received audio is decoded into, as 16kHz DAC words, for
+		analysis on other threads. Attach readers before streaming starts; each reads
+		frames in place with its own cursor, so the playout loop never copies or waits.
+	*/
+	BroadcastRing * ReceivedAudio();
+
+	/*
+		Prepares the 8 bit samples for the DAC being used
+		
+		@params:
+		samples - pointer to the 8 bit audio samples
+		modified - pointer to the modified array for 12bit data samples
+		data - pointer to the storage array to put the converted 8bit bytes
+		file_size - the number of samples
+	*/
+	int prepareSamplesForDac(UINT8 * samples, UINT16 * modified, UINT8 * data, DWORD file_size);
+
+	/*
+		Prepends the DAC control bits to the samples modified to the appropriate width for the DAC.
+		The control word and data width come from ActiveDac at compile time, samples go to channel A.
+
+		@params:
+		modified - pointer to the modified array for 12bit data samples
+		data - pointer to the storage array to put the converted 8bit bytes
+		file_size - the number of samples
+	*/
+	int prependControlBits(UINT8 * data, UINT16 * modified, DWORD file_size);
+
+	/*
+		Reads a PCM WAV file of any supported format and converts it to 12 bit DAC samples
+		at the playout rate
+
+		@params:
+		file_name - the WAV file to read
+		out_rate - the playout rate to convert to. If 0, files at 8kHz or lower play at 8kHz
+			and everything else at 16kHz; set to the chosen rate on return
+		modified - set to the array of 12 bit samples, the caller frees it
+		sample_count - set to the number of samples in modified
+
+		Returns 1 for success, 0 for failure
+	*/
+	int readWavFile(LPCWSTR file_name, UINT32 * out_rate, UINT16 ** modified, DWORD * sample_count);
+
+	/*
+		Plays PCM WAV files. 8, 16 and 24 bit mono or stereo files at common rates
+		are converted to 12 bit mono, at 8kHz for narrowband files and 16kHz otherwise.
+
+		@params:
+		file_name - the WAV file to play
+		dac_cs - the GPIO output connected to the dac cs pin
+	*/
+	int PlayWavFile(LPCWSTR file_name, int dac_cs);
+
+	/*
+		Handles one received packet. Reports are passed to the rate controller, audio frames
+		are checked by the link monitor and unpacked into 16kHz DAC words
+
+		@params:
+		packet - the received packet
+		length - the number of bytes received
+		words - storage for the DAC words, NULL to only handle reports
+		words_size - the size of words in bytes
+
+		Returns the number of bytes written to words
+	*/
+	int receivePacket(UINT8 * packet, int length, UINT8 * words, int words_size);
+
+	/*
+		Sends a receiver report back to the partner when one is due
+	*/
+	void sendReportIfDue();
+
+	/*
+		Plays two PCM WAV files at once. On a dual channel DAC each file gets its own
+		channel, on a single channel DAC the two are mixed. Both files are converted to
+		the playout rate picked for file_a.
+
+		@params:
+		file_a - the WAV file to play on channel A
+		file_b - the WAV file to play on channel B, NULL to play file_a alone
+		dac_cs - the GPIO output connected to the dac cs pin
+	*/
+	int PlayWavFiles(LPCWSTR file_a, LPCWSTR file_b, int dac_cs);
+
+	/*
+		Streams out a PCM WAV file, converted to 12 bit mono at out_rate. Sends the data
+		in chunks of size defined by buf_size
+
+		@params:
+		file_name - the WAV file to be streamed
+		buf_size - the number of samples to be sent,
+		actually ends up sending twice as many bytes as samples
+		out_rate - the rate the receiver plays at, WAV_RATE_8KHZ or WAV_RATE_16KHZ
+	*/
+	int StreamOutWavFile(LPCWSTR file_name, unsigned int buf_size, UINT32 out_rate = WAV_RATE_8KHZ);
+	
+	/*
+		Stream in 8-bit PCM 8kHz WAV data. Requires the DAC_CS pin to use, and the expected 
+		buffer size
+
+		@params:
+		dac_cs - the dac chip select, used to play alerts
+		buf_size - the number of samples to be sent, 
+			actually ends up receiving twice as many bytes as samples
+	*/
+	int StreamAndPlayAudio(int dac_cs, unsigned int buf_size);
+
+	/*
+		Streams out raw analog samples taken from the analog microphone feeding it's input 
+		to input_pin. Records audio at a 16kHz rate, streams until the button defined by 
+		control_pin is released. Frame size, send rate and redundancy follow the reports
+		sent back by the receiver
+
+		@params:
+		dac_cs - the dac chip select, used to play alerts
+		input_pin - the pin being fed analog audio data
+		control_pin - the button that needs to be held to stay in record mode
+		buffer_length_in_seconds - defines the largest frame to send, in seconds. 
+			One second of recorded audio has 16k samples
+	*/
+	int StreamOutAnalog(int dac_cs, int input_pin, int control_pin, int buffer_length_in_seconds);
+
+	/*
+		Streams in raw analog samples taken from another machine
+		Plays audio at a 16kHz rate, streams until the button defined by control_pin is pressed.
+		Reports loss, jitter and buffer depth back to the sender every LINK_REPORT_INTERVAL
+
+		@params:
+		dac_cs - the dac chip select, used to play alerts
+		control_pin - the button that needs to be held to stay in record mode
+		buffer_length_in_seconds - defines the size of the buffer to use, in seconds.
+			One second of recorded audio has 16k samples
+	*/
+	int StreamInAnalog(int dac_cs, int control_pin, int buffer_length_in_seconds);
+
+	/*
+		Streams raw analog samples in both directions at once, at a 16kHz rate.
+		Received audio is played while the microphone is recorded, and the echo of the
+		speaker is removed from the recording before it is sent. Holding the button
+		defined by control_pin mutes the microphone. Currently, this function doesn't return.
+
+		@params:
+		dac_cs - the dac chip select
+		input_pin - the pin being fed analog audio data
+		control_pin - the button that mutes the microphone while held
+		buffer_length_in_seconds - defines the size of the receive buffer to use, in seconds.
+			One second of recorded audio has 16k samples
+	*/
+	int StreamDuplexAnalog(int dac_cs, int input_pin, int control_pin, int buffer_length_in_seconds);
+
+
+};
+
+
 #endif
\ No newline at end of file
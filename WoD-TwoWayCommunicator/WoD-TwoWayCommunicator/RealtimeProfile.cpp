@@ -0,0 +1,151 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// RealtimeProfile.cpp : priority, affinity and memory locking for the sample loops
+
+#include "RealtimeProfile.h"
+
+//pages are at least this big on every Windows target, touching one byte per page prefaults it
+#define RT_PAGE_SIZE 4096
+
+RealtimeProfile::RealtimeProfile()
+{
+	m_enabled = false;
+	m_entered = false;
+	m_saved_priority = THREAD_PRIORITY_NORMAL;
+	m_saved_affinity = 0;
+	m_saved_class = NORMAL_PRIORITY_CLASS;
+}
+
+RealtimeProfile::~RealtimeProfile()
+{
+}
+
+/*
+	Turns the profile on or off, it is off by default
+
+	Returns 1 for success, 0 if the working set couldn't be changed
+*/
+int RealtimeProfile::setEnabled(bool enabled)
+{
+	if (enabled == m_enabled)
+	{
+		return 1;
+	}
+
+	//VirtualLock can only lock up to the minimum working set
+	if (enabled && !SetProcessWorkingSetSize(GetCurrentProcess(), RT_WORKING_SET_MIN, RT_WORKING_SET_MAX))
+	{
+		return 0;
+	}
+
+	m_enabled = enabled;
+	return 1;
+}
+
+/*
+	true if the profile is on
+*/
+bool RealtimeProfile::enabled()
+{
+	return m_enabled;
+}
+
+/*
+	Raises the process to high priority and the calling thread to time critical
+	priority, and pins the thread to RT_AUDIO_CPU
+*/
+void RealtimeProfile::enterAudioThread()
+{
+	HANDLE process = GetCurrentProcess();
+	HANDLE thread = GetCurrentThread();
+
+	if (!m_enabled || m_entered)
+	{
+		return;
+	}
+
+	/*
+		HIGH rather than REALTIME priority class: the sample loops busy wait, and
+		at realtime priority they would starve the network stack's own threads.
+		It only lasts while a loop runs, the rest of the time the process is as it was.
+	*/
+	m_saved_class = GetPriorityClass(process);
+	SetPriorityClass(process, HIGH_PRIORITY_CLASS);
+
+	m_saved_priority = GetThreadPriority(thread);
+	m_saved_affinity = SetThreadAffinityMask(thread, (DWORD_PTR)1 << RT_AUDIO_CPU);
+	SetThreadPriority(thread, THREAD_PRIORITY_TIME_CRITICAL);
+	m_entered = true;
+}
+
+/*
+	Puts back the priority class, thread priority and affinity from before enterAudioThread
+*/
+void RealtimeProfile::leaveAudioThread()
+{
+	HANDLE thread = GetCurrentThread();
+
+	if (!m_entered)
+	{
+		return;
+	}
+
+	SetThreadPriority(thread, m_saved_priority);
+	if (m_saved_affinity != 0)
+	{
+		SetThreadAffinityMask(thread, m_saved_affinity);
+	}
+	SetPriorityClass(GetCurrentProcess(), m_saved_class);
+	m_entered = false;
+}
+
+/*
+	Lets any other thread that is ready on the audio CPU run for a moment
+*/
+void RealtimeProfile::yield()
+{
+	/*
+		SwitchToThread rather than Sleep(0): Sleep(0) only gives way to threads of the
+		same priority or higher, which at time critical leaves out the recorder and
+		tracer writers. They only need the CPU briefly before waiting on the disk or
+		their poll timer again. Returns straight away when nothing else is ready.
+	*/
+	SwitchToThread();
+}
+
+/*
+	Touches every page of a buffer and locks it into the working set
+*/
+void RealtimeProfile::lockBuffer(void * buffer, SIZE_T size)
+{
+	volatile UINT8 * bytes = (volatile UINT8 *)buffer;
+
+	if (!m_enabled || buffer == NULL || size == 0)
+	{
+		return;
+	}
+
+	//write rather than read, so copy-on-write and demand-zero pages are really committed
+	for (SIZE_T n = 0; n < size; n += RT_PAGE_SIZE)
+	{
+		bytes[n] = bytes[n];
+	}
+	bytes[size - 1] = bytes[size - 1];
+
+	VirtualLock(buffer, size);
+}
+
+/*
+	Unlocks a buffer locked by lockBuffer, call before freeing it
+*/
+void RealtimeProfile::unlockBuffer(void * buffer, SIZE_T size)
+{
+	if (!m_enabled || buffer == NULL || size == 0)
+	{
+		return;
+	}
+
+	VirtualUnlock(buffer, size);
+}
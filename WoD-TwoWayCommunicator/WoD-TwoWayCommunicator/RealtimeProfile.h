@@ -0,0 +1,82 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* RealtimeProfile raises the priority of the sample loops, pins them to one CPU and
+* locks their buffers in memory, so a loaded system can't preempt them or page them out.
+* The sample loops busy wait, so they yield between frames to let the recorder and
+* tracer threads on the same CPU run.
+**/
+
+#ifndef REALTIMEPROFILE_H
+#define REALTIMEPROFILE_H
+
+#include "windows.h"
+
+//CPU the sample loops are pinned to
+#define RT_AUDIO_CPU 0
+
+//minimum working set requested so the locked buffers fit, in bytes
+#define RT_WORKING_SET_MIN (32 * 1024 * 1024)
+#define RT_WORKING_SET_MAX (64 * 1024 * 1024)
+
+class RealtimeProfile{
+public:
+	RealtimeProfile();
+	~RealtimeProfile();
+
+	/*
+		Turns the profile on or off, it is off by default. Turning it on grows the
+		working set so buffers can be locked.
+
+		Returns 1 for success, 0 if the working set couldn't be changed
+	*/
+	int setEnabled(bool enabled);
+
+	/*
+		true if the profile is on
+	*/
+	bool enabled();
+
+	/*
+		Raises the process to high priority and the calling thread to time critical
+		priority, and pins the thread to RT_AUDIO_CPU. Does nothing when the profile is off.
+	*/
+	void enterAudioThread();
+
+	/*
+		Puts back the priority class, thread priority and affinity from before enterAudioThread
+	*/
+	void leaveAudioThread();
+
+	/*
+		Lets any other thread that is ready on the audio CPU run for a moment, whatever
+		its priority. The sample loops call it between frames.
+	*/
+	void yield();
+
+	/*
+		Touches every page of a buffer so it is faulted in now rather than in a sample loop,
+		and locks it into the working set. Does nothing when the profile is off.
+
+		@params:
+		buffer - the buffer to lock
+		size - the size of the buffer in bytes
+	*/
+	void lockBuffer(void * buffer, SIZE_T size);
+
+	/*
+		Unlocks a buffer locked by lockBuffer, call before freeing it
+	*/
+	void unlockBuffer(void * buffer, SIZE_T size);
+
+private:
+	bool m_enabled;
+	bool m_entered;
+	int m_saved_priority; //priority of the audio thread before enterAudioThread
+	DWORD_PTR m_saved_affinity; //affinity of the audio thread before enterAudioThread
+	DWORD m_saved_class; //priority class of the process before enterAudioThread
+};
+
+#endif
@@ -0,0 +1,144 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// StreamProtocol.cpp : packs and unpacks streamed audio frames
+
+#include "StreamProtocol.h"
+#include "DacModel.h"
+#include "Tracer.h"
+
+//redundant copies can't be decimated further than this
+#define STREAM_MAX_DIVIDER 4
+
+/*
+	Averages each group of divider samples and packs the result as DAC words for channel A
+
+	Returns the number of words packed
+*/
+static DWORD packDecimated(UINT8 * data, const UINT16 * samples, DWORD count, UINT8 divider)
+{
+	typedef ActiveDac::Control<DAC_CHANNEL_A, DAC_GAIN_1X, false> control;
+	DWORD words = count / divider;
+
+	for (DWORD n = 0, x = 0; n < words; n++){
+		UINT32 sum = 0;
+		for (UINT8 r = 0; r < divider; r++)
+		{
+			sum += samples[x++];
+		}
+		UINT16 word = (UINT16)(control::word | ((sum / divider) & ActiveDac::data_mask));
+		data[2 * n] = (UINT8)(word >> 8);
+		data[2 * n + 1] = (UINT8)(word & 0xFF);
+	}
+
+	return words;
+}
+
+/*
+	Copies DAC words, repeating each one divider times to bring it back up to 16kHz
+
+	Returns the number of bytes written
+*/
+static DWORD unpackHeld(UINT8 * words, const UINT8 * data, DWORD count, UINT8 divider)
+{
+	DWORD n = 0;
+
+	for (DWORD x = 0; x < count; x++){
+		for (UINT8 r = 0; r < divider; r++)
+		{
+			words[n++] = data[2 * x];
+			words[n++] = data[2 * x + 1];
+		}
+	}
+
+	return n;
+}
+
+/*
+	Upper bound of the size of a packet made by encodeAudioFrame
+*/
+DWORD streamPacketSize(DWORD count, UINT8 rate_divider, DWORD previous_count)
+{
+	return sizeof(AudioFrameHeader) + 2 * (count / rate_divider) + 2 * (previous_count / (2 * rate_divider));
+}
+
+/*
+	Packs a frame of 12 bit samples captured at 16kHz into an audio packet
+
+	Returns the size of the packet in bytes
+*/
+DWORD encodeAudioFrame(UINT8 * packet, UINT32 sequence, UINT32 timestamp, const UINT16 * samples, DWORD count,
+	UINT8 rate_divider, const UINT16 * previous, DWORD previous_count)
+{
+	TRACE_SCOPE("encode");
+	AudioFrameHeader * header = (AudioFrameHeader *)packet;
+	UINT8 * payload = packet + sizeof(AudioFrameHeader);
+
+	header->type = STREAM_PACKET_AUDIO;
+	header->rate_divider = rate_divider;
+	header->reserved = 0;
+	header->sequence = sequence;
+	header->timestamp = timestamp;
+	header->sample_count = (UINT16)packDecimated(payload, samples, count, rate_divider);
+
+	if (previous != NULL && previous_count > 0)
+	{
+		header->redundant_divider = (UINT8)(2 * rate_divider);
+		header->redundant_count = (UINT16)packDecimated(&payload[2 * header->sample_count], previous, previous_count, header->redundant_divider);
+	}
+	else
+	{
+		header->redundant_divider = 0;
+		header->redundant_count = 0;
+	}
+
+	return sizeof(AudioFrameHeader) + 2 * (header->sample_count + header->redundant_count);
+}
+
+/*
+	Checks an audio packet and unpacks it into DAC words at 16kHz, ready to play
+
+	Returns the number of bytes written to words, 0 if the packet isn't a valid audio frame
+*/
+DWORD decodeAudioFrame(const UINT8 * packet, DWORD length, bool conceal, UINT8 * words, DWORD words_size)
+{
+	TRACE_SCOPE("decode");
+	const AudioFrameHeader * header = (const AudioFrameHeader *)packet;
+	const UINT8 * payload = packet + sizeof(AudioFrameHeader);
+	DWORD needed = 0;
+	DWORD n = 0;
+
+	if (length < sizeof(AudioFrameHeader) || header->type != STREAM_PACKET_AUDIO)
+	{
+		return 0;
+	}
+	if (header->rate_divider < 1 || header->rate_divider > 2 || header->redundant_divider > STREAM_MAX_DIVIDER)
+	{
+		return 0;
+	}
+	if (length != sizeof(AudioFrameHeader) + 2 * ((DWORD)header->sample_count + header->redundant_count))
+	{
+		return 0;
+	}
+
+	conceal = conceal && header->redundant_count > 0 && header->redundant_divider > 0;
+	needed = 2 * (DWORD)header->sample_count * header->rate_divider;
+	if (conceal)
+	{
+		needed += 2 * (DWORD)header->redundant_count * header->redundant_divider;
+	}
+	if (needed > words_size)
+	{
+		return 0;
+	}
+
+	//play the copy of the lost frame before this one
+	if (conceal)
+	{
+		n += unpackHeld(words, &payload[2 * header->sample_count], header->redundant_count, header->redundant_divider);
+	}
+	n += unpackHeld(&words[n], payload, header->sample_count, header->rate_divider);
+
+	return n;
+}
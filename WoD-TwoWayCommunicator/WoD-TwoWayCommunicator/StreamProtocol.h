@@ -0,0 +1,93 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* StreamProtocol defines the packets exchanged by two communicators while streaming
+* analog audio, and packs and unpacks audio frames
+**/
+
+#ifndef STREAMPROTOCOL_H
+#define STREAMPROTOCOL_H
+
+#include "windows.h"
+
+#define STREAM_PACKET_AUDIO 0xA5
+#define STREAM_PACKET_REPORT 0x5A
+
+//the sample clock all timestamps and frame sizes are counted in
+#define STREAM_CLOCK_RATE 16000
+
+#pragma pack(push, 1)
+
+/*
+	Header of an audio frame. It is followed by sample_count DAC words at
+	16kHz / rate_divider, then by redundant_count DAC words holding the previous
+	frame at 16kHz / redundant_divider, used to conceal a single lost frame.
+*/
+struct AudioFrameHeader{
+	UINT8 type; //STREAM_PACKET_AUDIO
+	UINT8 rate_divider; //1 for 16kHz, 2 for 8kHz
+	UINT8 redundant_divider; //rate divider of the redundant copy, 0 when there is none
+	UINT8 reserved;
+	UINT32 sequence; //frame counter, increments by one per frame
+	UINT32 timestamp; //sample clock of the first sample
+	UINT16 sample_count; //DAC words in this frame
+	UINT16 redundant_count; //DAC words in the redundant copy of the previous frame
+};
+
+/*
+	Periodic report sent back to the sender by the receiver
+*/
+struct ReceiverReport{
+	UINT8 type; //STREAM_PACKET_REPORT
+	UINT8 loss_fraction; //fraction of frames lost since the last report, out of 256
+	UINT16 buffer_depth; //milliseconds of audio waiting in the receive buffer
+	UINT32 highest_sequence; //highest frame sequence number received
+	UINT32 jitter; //interarrival jitter, in sample clock ticks
+};
+
+#pragma pack(pop)
+
+/*
+	Packs a frame of 12 bit samples captured at 16kHz into an audio packet. The frame is
+	decimated by rate_divider, and if previous is given a copy of it is appended,
+	decimated by twice rate_divider.
+
+	@params:
+	packet - storage for the packet, at least streamPacketSize(count, rate_divider, previous_count) bytes
+	sequence - the frame sequence number
+	timestamp - the sample clock of the first sample
+	samples - the 12 bit samples captured at 16kHz
+	count - the number of samples
+	rate_divider - 1 to send at 16kHz, 2 to send at 8kHz
+	previous - the samples of the previous frame, NULL for no redundancy
+	previous_count - the number of samples in previous
+
+	Returns the size of the packet in bytes
+*/
+DWORD encodeAudioFrame(UINT8 * packet, UINT32 sequence, UINT32 timestamp, const UINT16 * samples, DWORD count,
+	UINT8 rate_divider, const UINT16 * previous, DWORD previous_count);
+
+/*
+	Upper bound of the size of a packet made by encodeAudioFrame
+*/
+DWORD streamPacketSize(DWORD count, UINT8 rate_divider, DWORD previous_count);
+
+/*
+	Checks an audio packet and unpacks it into DAC words at 16kHz, ready to play.
+	If the previous frame was lost and the packet carries a copy of it, that copy is
+	unpacked first.
+
+	@params:
+	packet - the received packet
+	length - the number of bytes received
+	conceal - true if the frame before this one was lost
+	words - storage for the DAC words, two bytes per word
+	words_size - the size of words in bytes
+
+	Returns the number of bytes written to words, 0 if the packet isn't a valid audio frame
+*/
+DWORD decodeAudioFrame(const UINT8 * packet, DWORD length, bool conceal, UINT8 * words, DWORD words_size);
+
+#endif
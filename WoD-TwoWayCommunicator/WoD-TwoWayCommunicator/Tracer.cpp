@@ -0,0 +1,343 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// Tracer.cpp : timeline tracing in the trace event JSON format
+
+#include "stdafx.h"
+#include "Tracer.h"
+
+//bytes of JSON gathered before each write to the trace file
+#define TRACE_WRITE_SIZE (64 * 1024)
+
+//longest line written for one event
+#define TRACE_LINE_SIZE 256
+
+#define TRACE_SAMPLE_RATE 16000
+
+static TraceBuffer * volatile s_buffers[TRACE_MAX_THREADS];
+static volatile LONG s_buffer_count = 0;
+static volatile LONG s_running = 0;
+static volatile LONG s_stop = 0;
+static volatile LONG s_dropped = 0;
+static LONGLONG s_frequency = 1;
+static LONGLONG s_origin = 0; //performance counter when tracing started
+static HANDLE s_file = INVALID_HANDLE_VALUE;
+static HANDLE s_thread = NULL;
+static char * s_json = NULL; //JSON waiting to be written
+static DWORD s_json_size = 0;
+
+//each thread's buffer, registered on its first event
+static __declspec(thread) TraceBuffer * s_thread_buffer = NULL;
+
+/*
+	Starts tracing into a new trace file
+
+	Returns 1 for success, 0 for failure
+*/
+int Tracer::start(LPCWSTR file_name)
+{
+	LARGE_INTEGER value;
+	DWORD written = 0;
+
+	if (s_running)
+	{
+		return 0;
+	}
+
+	s_json = (char *)malloc(TRACE_WRITE_SIZE);
+	if (s_json == NULL)
+	{
+		return 0;
+	}
+
+	s_file = CreateFile(file_name, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (s_file == INVALID_HANDLE_VALUE)
+	{
+		free(s_json);
+		s_json = NULL;
+		return 0;
+	}
+
+	//the JSON array format, viewers accept a file cut off without its closing bracket
+	WriteFile(s_file, "[\n", 2, &written, NULL);
+	s_json_size = 0;
+
+	QueryPerformanceFrequency(&value);
+	s_frequency = value.QuadPart;
+	QueryPerformanceCounter(&value);
+	s_origin = value.QuadPart;
+
+	s_stop = 0;
+	s_dropped = 0;
+	s_thread = CreateThread(NULL, 0, writerThread, NULL, 0, NULL);
+	if (s_thread == NULL)
+	{
+		CloseHandle(s_file);
+		s_file = INVALID_HANDLE_VALUE;
+		free(s_json);
+		s_json = NULL;
+		return 0;
+	}
+	SetThreadPriority(s_thread, THREAD_PRIORITY_BELOW_NORMAL);
+
+	InterlockedExchange(&s_running, 1);
+	return 1;
+}
+
+/*
+	Writes out the remaining events and closes the trace file. Threads still
+	recording lose any events they add from here on.
+*/
+void Tracer::stop()
+{
+	DWORD written = 0;
+
+	if (!s_running)
+	{
+		return;
+	}
+
+	InterlockedExchange(&s_running, 0);
+	InterlockedExchange(&s_stop, 1);
+	WaitForSingleObject(s_thread, INFINITE);
+	CloseHandle(s_thread);
+	s_thread = NULL;
+
+	//a metadata event to end on, so the last event can keep its trailing comma
+	_snprintf_s(s_json, TRACE_WRITE_SIZE, _TRUNCATE,
+		"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Communicator\"}}\n]\n");
+	WriteFile(s_file, s_json, (DWORD)strlen(s_json), &written, NULL);
+	CloseHandle(s_file);
+	s_file = INVALID_HANDLE_VALUE;
+
+	free(s_json);
+	s_json = NULL;
+}
+
+/*
+	Names the calling thread in the timeline
+*/
+void Tracer::nameThread(const char * name)
+{
+	TraceBuffer * buffer = threadBuffer();
+
+	if (buffer != NULL)
+	{
+		buffer->thread_name = name;
+	}
+}
+
+/*
+	Records an event that started at start and ends now, and an instant deadline
+	miss if it took longer than deadline ticks
+*/
+void Tracer::complete(const char * name, LONGLONG start, LONGLONG deadline)
+{
+	LONGLONG end;
+
+	if (!s_running)
+	{
+		return;
+	}
+
+	end = now();
+	record('X', name, start, (UINT32)(end - start), 0);
+
+	if (deadline > 0 && end - start > deadline)
+	{
+		record('i', "deadline miss", end, 0, (UINT32)((end - start - deadline) * 1000000 / s_frequency));
+	}
+}
+
+/*
+	Returns the performance counter
+*/
+LONGLONG Tracer::now()
+{
+	LARGE_INTEGER value;
+
+	QueryPerformanceCounter(&value);
+	return value.QuadPart;
+}
+
+/*
+	Returns the ticks a frame of samples at 16kHz should take, with the slack
+	allowed before it counts as a deadline miss
+*/
+LONGLONG Tracer::frameDeadline(DWORD samples)
+{
+	LONGLONG nominal = (LONGLONG)samples * s_frequency / TRACE_SAMPLE_RATE;
+
+	return nominal + nominal / 32 + TRACE_DEADLINE_SLACK_US * s_frequency / 1000000;
+}
+
+/*
+	Events dropped because a thread's buffer was full
+*/
+LONG Tracer::droppedEvents()
+{
+	return s_dropped;
+}
+
+/*
+	Returns the calling thread's buffer, registering one on first use
+*/
+TraceBuffer * Tracer::threadBuffer()
+{
+	if (s_thread_buffer != NULL || !s_running)
+	{
+		return s_thread_buffer;
+	}
+
+	LONG slot = InterlockedIncrement(&s_buffer_count) - 1;
+	if (slot >= TRACE_MAX_THREADS)
+	{
+		return NULL;
+	}
+
+	TraceBuffer * buffer = (TraceBuffer *)malloc(sizeof(TraceBuffer));
+	if (buffer == NULL)
+	{
+		return NULL;
+	}
+	buffer->head = 0;
+	buffer->tail = 0;
+	buffer->thread_id = GetCurrentThreadId();
+	buffer->thread_name = NULL;
+	buffer->named = false;
+
+	//buffers are never freed, a thread that exits leaves its events to be written out
+	MemoryBarrier();
+	s_buffers[slot] = buffer;
+	s_thread_buffer = buffer;
+	return buffer;
+}
+
+/*
+	Adds an event to the calling thread's buffer
+*/
+void Tracer::record(char phase, const char * name, LONGLONG timestamp, UINT32 duration, UINT32 value)
+{
+	TraceBuffer * buffer = threadBuffer();
+	if (buffer == NULL)
+	{
+		return;
+	}
+
+	LONG head = buffer->head;
+	if (head - buffer->tail >= TRACE_BUFFER_EVENTS)
+	{
+		InterlockedIncrement(&s_dropped);
+		return;
+	}
+
+	TraceEvent * event = &buffer->events[head % TRACE_BUFFER_EVENTS];
+	event->name = name;
+	event->timestamp = timestamp;
+	event->duration = duration;
+	event->value = value;
+	event->phase = phase;
+
+	//publish the event only once it is filled in
+	MemoryBarrier();
+	buffer->head = head + 1;
+}
+
+/*
+	Entry point of the writer thread
+*/
+DWORD WINAPI Tracer::writerThread(LPVOID param)
+{
+	TRACE_THREAD_NAME("trace writer");
+
+	while (s_stop == 0)
+	{
+		Sleep(TRACE_FLUSH_MS);
+		flush();
+	}
+
+	//pick up anything recorded while stopping
+	flush();
+	return 0;
+}
+
+/*
+	Adds a line to the JSON waiting to be written, writing it out first if full
+*/
+void Tracer::append(const char * line, int size)
+{
+	DWORD written = 0;
+
+	if (size <= 0)
+	{
+		return;
+	}
+	if (s_json_size + size > TRACE_WRITE_SIZE)
+	{
+		WriteFile(s_file, s_json, s_json_size, &written, NULL);
+		s_json_size = 0;
+	}
+	memcpy(&s_json[s_json_size], line, size);
+	s_json_size += size;
+}
+
+/*
+	Appends the events recorded since the last call to the trace file
+*/
+void Tracer::flush()
+{
+	char line[TRACE_LINE_SIZE];
+	DWORD written = 0;
+	LONG count = min(s_buffer_count, (LONG)TRACE_MAX_THREADS);
+
+	for (LONG b = 0; b < count; b++)
+	{
+		TraceBuffer * buffer = s_buffers[b];
+		if (buffer == NULL)
+		{
+			//registered but not filled in yet, next time
+			continue;
+		}
+
+		LONG head = buffer->head;
+		MemoryBarrier();
+
+		if (!buffer->named && buffer->thread_name != NULL)
+		{
+			append(line, _snprintf_s(line, TRACE_LINE_SIZE, _TRUNCATE,
+				"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"%s\"}},\n",
+				(unsigned long)buffer->thread_id, buffer->thread_name));
+			buffer->named = true;
+		}
+
+		for (LONG e = buffer->tail; e < head; e++)
+		{
+			const TraceEvent * event = &buffer->events[e % TRACE_BUFFER_EVENTS];
+			double timestamp = (event->timestamp - s_origin) * 1000000.0 / s_frequency;
+
+			if (event->phase == 'X')
+			{
+				append(line, _snprintf_s(line, TRACE_LINE_SIZE, _TRUNCATE,
+					"{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%lu},\n",
+					event->name, timestamp, event->duration * 1000000.0 / s_frequency, (unsigned long)buffer->thread_id));
+			}
+			else
+			{
+				append(line, _snprintf_s(line, TRACE_LINE_SIZE, _TRUNCATE,
+					"{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%lu,\"args\":{\"late_us\":%u}},\n",
+					event->name, timestamp, (unsigned long)buffer->thread_id, event->value));
+			}
+		}
+
+		//hand the slots back only after they have been read
+		MemoryBarrier();
+		buffer->tail = head;
+	}
+
+	if (s_json_size > 0)
+	{
+		WriteFile(s_file, s_json, s_json_size, &written, NULL);
+		s_json_size = 0;
+	}
+}
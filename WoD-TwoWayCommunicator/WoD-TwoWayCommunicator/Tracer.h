@@ -0,0 +1,194 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* Tracer records a timeline of the audio pipeline in the trace event JSON format, to be
+* opened in Perfetto or chrome://tracing. Each thread records into its own buffer
+* without locks, and a background thread appends the events to the trace file.
+*
+* Trace points are written with the TRACE_ macros, which compile to nothing unless
+* ENABLE_TRACE is defined in the project's preprocessor definitions.
+**/
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include "windows.h"
+
+//events each thread can hold before the writer catches up, later ones are dropped
+#define TRACE_BUFFER_EVENTS 16384
+
+//most threads that can record events
+#define TRACE_MAX_THREADS 32
+
+//how often the writer appends recorded events to the file
+#define TRACE_FLUSH_MS 100
+
+//a frame is a deadline miss once it runs past its nominal length by more than 1/32 of that
+//length plus this many microseconds, as the delay loops are only tuned by hand
+#define TRACE_DEADLINE_SLACK_US 2000
+
+struct TraceEvent{
+	const char * name;
+	LONGLONG timestamp; //performance counter ticks
+	UINT32 duration; //performance counter ticks, complete events only
+	UINT32 value; //microseconds late, deadline misses only
+	char phase; //'X' complete, 'i' instant
+};
+
+/*
+	Events recorded by one thread. Only that thread adds events and only the writer
+	thread takes them, so the two counters are all the synchronisation needed.
+*/
+struct TraceBuffer{
+	TraceEvent events[TRACE_BUFFER_EVENTS];
+	volatile LONG head; //events added, only the recording thread changes this
+	volatile LONG tail; //events written out, only the writer changes this
+	DWORD thread_id;
+	const char * volatile thread_name;
+	bool named; //the thread name has been written out
+};
+
+class Tracer{
+public:
+	/*
+		Starts tracing into a new trace file
+
+		@params:
+		file_name - the trace file to write
+
+		Returns 1 for success, 0 for failure
+	*/
+	static int start(LPCWSTR file_name);
+
+	/*
+		Writes out the remaining events and closes the trace file
+	*/
+	static void stop();
+
+	/*
+		Names the calling thread in the timeline
+
+		@params:
+		name - a string that lives as long as the program, usually a literal
+	*/
+	static void nameThread(const char * name);
+
+	/*
+		Records an event that started at start and ends now, and an instant deadline
+		miss if it took longer than deadline ticks
+
+		@params:
+		name - a string that lives as long as the program, usually a literal
+		start - the performance counter when the event started
+		deadline - how many ticks the event should take, 0 for no deadline
+	*/
+	static void complete(const char * name, LONGLONG start, LONGLONG deadline);
+
+	/*
+		Returns the performance counter
+	*/
+	static LONGLONG now();
+
+	/*
+		Returns the ticks a frame of samples at 16kHz should take, with the slack
+		allowed before it counts as a deadline miss
+	*/
+	static LONGLONG frameDeadline(DWORD samples);
+
+	/*
+		Events dropped because a thread's buffer was full
+	*/
+	static LONG droppedEvents();
+
+private:
+	/*
+		Returns the calling thread's buffer, registering one on first use.
+		NULL if tracing isn't running or there are too many threads.
+	*/
+	static TraceBuffer * threadBuffer();
+
+	/*
+		Adds an event to the calling thread's buffer
+	*/
+	static void record(char phase, const char * name, LONGLONG timestamp, UINT32 duration, UINT32 value);
+
+	/*
+		Entry point of the writer thread
+	*/
+	static DWORD WINAPI writerThread(LPVOID param);
+
+	/*
+		Adds a line to the JSON waiting to be written, writing it out first if full
+	*/
+	static void append(const char * line, int size);
+
+	/*
+		Appends the events recorded since the last call to the trace file
+	*/
+	static void flush();
+};
+
+/*
+	Records the time from its construction to the end of the enclosing scope
+*/
+class TraceScope{
+public:
+	TraceScope(const char * name, LONGLONG deadline = 0)
+	{
+		m_name = name;
+		m_deadline = deadline;
+		m_start = Tracer::now();
+	}
+
+	~TraceScope()
+	{
+		if (m_name != NULL)
+		{
+			Tracer::complete(m_name, m_start, m_deadline);
+		}
+	}
+
+	/*
+		Drops the event, for calls that turn out to have done nothing
+	*/
+	void cancel()
+	{
+		m_name = NULL;
+	}
+
+private:
+	const char * m_name;
+	LONGLONG m_start;
+	LONGLONG m_deadline;
+};
+
+#ifdef ENABLE_TRACE
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+//records the rest of the enclosing scope
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+//records the rest of the enclosing scope, which should take as long as samples at 16kHz
+#define TRACE_SCOPE_DEADLINE(name, samples) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, Tracer::frameDeadline(samples))
+
+//a scope that can be cancelled with TRACE_CANCEL
+#define TRACE_SCOPE_NAMED(variable, name) TraceScope variable(name)
+#define TRACE_CANCEL(variable) variable.cancel()
+
+#define TRACE_THREAD_NAME(name) Tracer::nameThread(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_DEADLINE(name, samples)
+#define TRACE_SCOPE_NAMED(variable, name)
+#define TRACE_CANCEL(variable) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+#endif
+
+#endif
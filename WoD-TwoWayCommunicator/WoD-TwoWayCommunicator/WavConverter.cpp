@@ -0,0 +1,413 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+// WavConverter.cpp : parses WAV headers and converts PCM data to 12 bit DAC samples
+
+#include "WavConverter.h"
+
+#include <math.h>
+
+#define WAV_PI 3.14159265358979323846
+
+//fraction of the output Nyquist frequency kept by the anti-aliasing filter
+#define RESAMPLER_CUTOFF 0.85
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+//reads little endian values out of a byte buffer
+#define READ_LE16(p) ((UINT16)((p)[0] | ((p)[1] << 8)))
+#define READ_LE32(p) ((UINT32)((p)[0] | ((p)[1] << 8) | ((p)[2] << 16) | ((UINT32)(p)[3] << 24)))
+
+//writes little endian values into a byte buffer
+#define WRITE_LE16(p, v) { (p)[0] = (UINT8)(v); (p)[1] = (UINT8)((v) >> 8); }
+#define WRITE_LE32(p, v) { WRITE_LE16(p, (v) & 0xFFFF); WRITE_LE16((p) + 2, (v) >> 16); }
+
+static UINT32 greatestCommonDivisor(UINT32 a, UINT32 b)
+{
+	while (b != 0)
+	{
+		UINT32 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static int isSupportedRate(UINT32 rate)
+{
+	switch (rate)
+	{
+	case 8000:
+	case 11025:
+	case 16000:
+	case 22050:
+	case 32000:
+	case 44100:
+	case 48000:
+		return 1;
+	}
+	return 0;
+}
+
+WavConverter::WavConverter()
+{
+	m_coefficients = NULL;
+	m_history = NULL;
+	m_passthrough = true;
+	m_up = 1;
+	m_down = 1;
+	m_phase = 0;
+	m_taps = 0;
+	m_history_pos = 0;
+	m_carry_size = 0;
+	memset(&m_format, 0, sizeof(m_format));
+}
+
+WavConverter::~WavConverter()
+{
+	free(m_coefficients);
+	free(m_history);
+}
+
+/*
+	Reads the RIFF header of an open WAV file, leaving the file pointer at the
+	start of the PCM data
+
+	Returns 1 for success, 0 if the file isn't a supported PCM WAV file
+*/
+int WavConverter::readWavHeader(HANDLE wav_file, WavFormat * format)
+{
+	UINT8 header[16];
+	DWORD bytes_read = 0;
+	bool have_format = false;
+
+	if (wav_file == INVALID_HANDLE_VALUE)
+	{
+		return 0;
+	}
+
+	//"RIFF" <size> "WAVE"
+	if (!ReadFile(wav_file, header, 12, &bytes_read, NULL) || bytes_read != 12)
+	{
+		return 0;
+	}
+	if (memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+	{
+		return 0;
+	}
+
+	//walk the chunks until the data chunk is found
+	while (true)
+	{
+		if (!ReadFile(wav_file, header, 8, &bytes_read, NULL) || bytes_read != 8)
+		{
+			return 0;
+		}
+		UINT32 chunk_size = READ_LE32(header + 4);
+
+		if (memcmp(header, "fmt ", 4) == 0)
+		{
+			if (chunk_size < 16 || !ReadFile(wav_file, header, 16, &bytes_read, NULL) || bytes_read != 16)
+			{
+				return 0;
+			}
+			UINT16 format_tag = READ_LE16(header);
+			if (format_tag != WAV_FORMAT_PCM && format_tag != WAV_FORMAT_EXTENSIBLE)
+			{
+				return 0;
+			}
+			format->channels = READ_LE16(header + 2);
+			format->sample_rate = READ_LE32(header + 4);
+			format->block_align = READ_LE16(header + 12);
+			format->bits_per_sample = READ_LE16(header + 14);
+			have_format = true;
+
+			//skip the extension bytes and padding
+			chunk_size -= 16;
+		}
+		else if (memcmp(header, "data", 4) == 0)
+		{
+			if (!have_format)
+			{
+				return 0;
+			}
+
+			//streaming writers leave the size at 0 or 0xFFFFFFFF, clamp to what's in the file
+			DWORD position = SetFilePointer(wav_file, 0, NULL, FILE_CURRENT);
+			DWORD remaining = GetFileSize(wav_file, NULL) - position;
+			format->data_size = (chunk_size == 0 || chunk_size > remaining) ? remaining : chunk_size;
+			break;
+		}
+
+		SetFilePointer(wav_file, chunk_size + (chunk_size & 1), NULL, FILE_CURRENT);
+	}
+
+	if (format->channels < 1 || format->channels > 2)
+	{
+		return 0;
+	}
+	if (format->bits_per_sample != 8 && format->bits_per_sample != 16 && format->bits_per_sample != 24)
+	{
+		return 0;
+	}
+	if (format->block_align != format->channels * (format->bits_per_sample / 8))
+	{
+		return 0;
+	}
+	if (!isSupportedRate(format->sample_rate))
+	{
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+	Writes the header of a 16 bit mono PCM WAV file at the current file pointer
+
+	Returns 1 for success, 0 for failure
+*/
+int WavConverter::writeWavHeader(HANDLE wav_file, UINT32 sample_rate, DWORD data_size)
+{
+	UINT8 header[WAV_HEADER_SIZE];
+	DWORD written = 0;
+
+	if (wav_file == INVALID_HANDLE_VALUE)
+	{
+		return 0;
+	}
+
+	memcpy(header, "RIFF", 4);
+	WRITE_LE32(header + 4, data_size + WAV_HEADER_SIZE - 8);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	WRITE_LE32(header + 16, 16);
+	WRITE_LE16(header + 20, WAV_FORMAT_PCM);
+	WRITE_LE16(header + 22, 1); //mono
+	WRITE_LE32(header + 24, sample_rate);
+	WRITE_LE32(header + 28, sample_rate * 2); //bytes per second
+	WRITE_LE16(header + 32, 2); //block align
+	WRITE_LE16(header + 34, 16); //bits per sample
+	memcpy(header + 36, "data", 4);
+	WRITE_LE32(header + 40, data_size);
+
+	return (WriteFile(wav_file, header, WAV_HEADER_SIZE, &written, NULL) && written == WAV_HEADER_SIZE) ? 1 : 0;
+}
+
+/*
+	Prepares the converter for a given input format and playout rate.
+	Designs a windowed-sinc low pass filter and splits it into m_up polyphase
+	branches, so only the taps that line up with real input samples are computed.
+
+	Returns 1 for success, 0 if the conversion isn't supported
+*/
+int WavConverter::configure(const WavFormat & format, UINT32 out_rate)
+{
+	if (out_rate != WAV_RATE_8KHZ && out_rate != WAV_RATE_16KHZ)
+	{
+		return 0;
+	}
+
+	m_format = format;
+	m_carry_size = 0;
+	m_phase = 0;
+	m_history_pos = 0;
+
+	free(m_coefficients);
+	free(m_history);
+	m_coefficients = NULL;
+	m_history = NULL;
+
+	UINT32 divisor = greatestCommonDivisor(out_rate, format.sample_rate);
+	m_up = out_rate / divisor;
+	m_down = format.sample_rate / divisor;
+	m_passthrough = (m_up == 1 && m_down == 1);
+
+	if (m_passthrough)
+	{
+		return 1;
+	}
+
+	//widen the branches when decimating so the transition band stays narrow
+	UINT32 ratio = (m_down + m_up - 1) / m_up;
+	m_taps = RESAMPLER_TAPS * ratio;
+
+	UINT32 length = m_up * m_taps;
+	double center = (length - 1) / 2.0;
+	double cutoff = RESAMPLER_CUTOFF * 0.5 / max(m_up, m_down); //cycles per interpolated sample
+	double * prototype = (double *)malloc(sizeof(double)* length);
+
+	m_coefficients = (INT16 *)malloc(sizeof(INT16)* length);
+	m_history = (INT16 *)malloc(sizeof(INT16)* m_taps * 2);
+	if (prototype == NULL || m_coefficients == NULL || m_history == NULL)
+	{
+		free(prototype);
+		return 0;
+	}
+	memset(m_history, 0, sizeof(INT16)* m_taps * 2);
+
+	//Blackman windowed sinc
+	for (UINT32 n = 0; n < length; n++)
+	{
+		double t = n - center;
+		double sinc = (t == 0.0) ? 2.0 * cutoff : sin(2.0 * WAV_PI * cutoff * t) / (WAV_PI * t);
+		double window = 0.42 - 0.5 * cos(2.0 * WAV_PI * n / (length - 1)) + 0.08 * cos(4.0 * WAV_PI * n / (length - 1));
+		prototype[n] = sinc * window;
+	}
+
+	//split into branches, normalize each to unity gain and store reversed in Q15
+	for (UINT32 p = 0; p < m_up; p++)
+	{
+		double sum = 0.0;
+		for (UINT32 k = 0; k < m_taps; k++)
+		{
+			sum += prototype[p + k * m_up];
+		}
+		for (UINT32 k = 0; k < m_taps; k++)
+		{
+			double value = prototype[p + k * m_up] / sum * 32768.0;
+			value = (value > 32767.0) ? 32767.0 : ((value < -32768.0) ? -32768.0 : value);
+			m_coefficients[p * m_taps + (m_taps - 1 - k)] = (INT16)floor(value + 0.5);
+		}
+	}
+
+	free(prototype);
+	return 1;
+}
+
+/*
+	Upper bound of the number of samples convert() produces for in_bytes of input
+*/
+DWORD WavConverter::maxOutputSamples(DWORD in_bytes)
+{
+	DWORD frames = (in_bytes + m_carry_size) / m_format.block_align + 1;
+	return (DWORD)(((UINT64)frames * m_up) / m_down) + 1;
+}
+
+/*
+	Decodes one frame and downmixes it to a signed 16 bit mono sample
+*/
+INT16 WavConverter::decodeFrame(const UINT8 * frame)
+{
+	INT32 left;
+	INT32 right;
+
+	switch (m_format.bits_per_sample)
+	{
+	case 8:
+		left = ((INT32)frame[0] - 128) << 8;
+		right = (m_format.channels == 2) ? ((INT32)frame[1] - 128) << 8 : left;
+		break;
+	case 16:
+		left = (INT16)READ_LE16(frame);
+		right = (m_format.channels == 2) ? (INT16)READ_LE16(frame + 2) : left;
+		break;
+	default:
+		//24 bit, the low byte is below the DAC's resolution
+		left = (INT16)READ_LE16(frame + 1);
+		right = (m_format.channels == 2) ? (INT16)READ_LE16(frame + 4) : left;
+		break;
+	}
+
+	return (INT16)((left + right) >> 1);
+}
+
+/*
+	Pushes one mono sample through the polyphase filter, returns the number of
+	samples written to out
+*/
+DWORD WavConverter::resample(INT16 sample, UINT16 * out)
+{
+	DWORD produced = 0;
+
+	m_history_pos = (m_history_pos + 1 == m_taps) ? 0 : m_history_pos + 1;
+	m_history[m_history_pos] = sample;
+	m_history[m_history_pos + m_taps] = sample;
+
+	//oldest to newest sample, contiguous thanks to the doubled history
+	const INT16 * window = &m_history[m_history_pos + 1];
+
+	while (m_phase < m_up)
+	{
+		const INT16 * taps = &m_coefficients[m_phase * m_taps];
+
+		//four independent accumulators keep the multiply pipeline full
+		INT32 acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+		for (UINT32 k = 0; k < m_taps; k += 4)
+		{
+			acc0 += window[k] * taps[k];
+			acc1 += window[k + 1] * taps[k + 1];
+			acc2 += window[k + 2] * taps[k + 2];
+			acc3 += window[k + 3] * taps[k + 3];
+		}
+		INT32 value = (acc0 + acc1 + acc2 + acc3 + (1 << 14)) >> 15;
+		value = (value > 32767) ? 32767 : ((value < -32768) ? -32768 : value);
+
+		//signed 16 bit to unsigned 12 bit for the DAC
+		out[produced++] = (UINT16)((value + 32768) >> 4);
+		m_phase += m_down;
+	}
+	m_phase -= m_up;
+
+	return produced;
+}
+
+/*
+	Converts a block of PCM data. Blocks may be any size and may split frames,
+	state is carried over to the next call.
+
+	Returns the number of samples written to out
+*/
+DWORD WavConverter::convert(const UINT8 * in, DWORD in_bytes, UINT16 * out)
+{
+	DWORD produced = 0;
+	DWORD n = 0;
+	UINT32 block_align = m_format.block_align;
+
+	//finish a frame left over from the previous block
+	if (m_carry_size > 0)
+	{
+		while (m_carry_size < block_align && n < in_bytes)
+		{
+			m_carry[m_carry_size++] = in[n++];
+		}
+		if (m_carry_size < block_align)
+		{
+			return 0;
+		}
+		INT16 sample = decodeFrame(m_carry);
+		if (m_passthrough)
+		{
+			out[produced++] = (UINT16)((sample + 32768) >> 4);
+		}
+		else
+		{
+			produced += resample(sample, &out[produced]);
+		}
+		m_carry_size = 0;
+	}
+
+	if (m_passthrough)
+	{
+		for (; n + block_align <= in_bytes; n += block_align)
+		{
+			out[produced++] = (UINT16)((decodeFrame(&in[n]) + 32768) >> 4);
+		}
+	}
+	else
+	{
+		for (; n + block_align <= in_bytes; n += block_align)
+		{
+			produced += resample(decodeFrame(&in[n]), &out[produced]);
+		}
+	}
+
+	//keep a partial frame for the next block
+	while (n < in_bytes)
+	{
+		m_carry[m_carry_size++] = in[n++];
+	}
+
+	return produced;
+}
@@ -0,0 +1,122 @@
+// Copyright(c) Microsoft Open Technologies, Inc. All rights reserved.
+// Licensed under the BSD 2 - Clause License.
+// See License.txt in the project root for license information.
+
+/**
+* WavConverter parses WAV headers and converts PCM data of any common format
+* into 12 bit DAC samples at the playout rate
+**/
+
+#ifndef WAVCONVERTER_H
+#define WAVCONVERTER_H
+
+#include "windows.h"
+
+//playout rates supported by the DAC loops in RawAudio
+#define WAV_RATE_8KHZ 8000
+#define WAV_RATE_16KHZ 16000
+
+//size of the header written by writeWavHeader
+#define WAV_HEADER_SIZE 44
+
+//taps in each polyphase branch of the resampling filter, must be a multiple of 4
+//when decimating this is scaled up by the decimation ratio to keep the cutoff sharp
+#define RESAMPLER_TAPS 24
+
+/*
+	Description of the PCM data in a WAV file
+*/
+struct WavFormat{
+	UINT16 channels;
+	UINT32 sample_rate;
+	UINT16 bits_per_sample;
+	UINT16 block_align; //bytes per frame (all channels)
+	DWORD data_size; //bytes of PCM data following the header
+};
+
+class WavConverter{
+public:
+	WavConverter();
+	~WavConverter();
+
+	/*
+		Reads the RIFF header of an open WAV file, leaving the file pointer at the
+		start of the PCM data
+
+		@params:
+		wav_file - handle of the open WAV file
+		format - filled in with the format of the PCM data
+
+		Returns 1 for success, 0 if the file isn't a supported PCM WAV file
+	*/
+	static int readWavHeader(HANDLE wav_file, WavFormat * format);
+
+	/*
+		Writes the header of a 16 bit mono PCM WAV file at the current file pointer,
+		leaving the file pointer at the start of the PCM data
+
+		@params:
+		wav_file - handle of the open WAV file
+		sample_rate - the sample rate of the PCM data
+		data_size - bytes of PCM data following the header, 0 if not known yet
+
+		Returns 1 for success, 0 for failure
+	*/
+	static int writeWavHeader(HANDLE wav_file, UINT32 sample_rate, DWORD data_size);
+
+	/*
+		Prepares the converter for a given input format and playout rate.
+		Any state left from a previous stream is discarded.
+
+		@params:
+		format - the format of the input PCM data
+		out_rate - the playout rate, WAV_RATE_8KHZ or WAV_RATE_16KHZ
+
+		Returns 1 for success, 0 if the conversion isn't supported
+	*/
+	int configure(const WavFormat & format, UINT32 out_rate);
+
+	/*
+		Upper bound of the number of samples convert() produces for in_bytes of input
+	*/
+	DWORD maxOutputSamples(DWORD in_bytes);
+
+	/*
+		Converts a block of PCM data. Blocks may be any size and may split frames,
+		state is carried over to the next call.
+
+		@params:
+		in - pointer to the raw PCM bytes
+		in_bytes - the number of bytes in the block
+		out - storage for the 12 bit DAC samples, at least maxOutputSamples(in_bytes) long
+
+		Returns the number of samples written to out
+	*/
+	DWORD convert(const UINT8 * in, DWORD in_bytes, UINT16 * out);
+
+private:
+	/*
+		Decodes one frame and downmixes it to a signed 16 bit mono sample
+	*/
+	INT16 decodeFrame(const UINT8 * frame);
+
+	/*
+		Pushes one mono sample through the polyphase filter, returns the number of
+		samples written to out
+	*/
+	DWORD resample(INT16 sample, UINT16 * out);
+
+	WavFormat m_format;
+	bool m_passthrough; //input is already at the playout rate
+	UINT32 m_up; //interpolation factor L
+	UINT32 m_down; //decimation factor M
+	UINT32 m_phase; //current polyphase branch, in units of 1/L input samples
+	UINT32 m_taps; //taps per polyphase branch
+	INT16 * m_coefficients; //Q15 taps, m_up branches of m_taps each, reversed
+	INT16 * m_history; //last m_taps input samples, stored twice to avoid wrapping
+	UINT32 m_history_pos;
+	UINT8 m_carry[8]; //bytes of a frame split across two blocks
+	UINT32 m_carry_size;
+};
+
+#endif